@@ -43,13 +43,30 @@
 #include <errno.h>
 #include "bwxform.h"
 
+#ifdef BWT_PROFILE
+#include <time.h>
+#endif
+
 /***************************************************************************
 *                                CONSTANTS
 ***************************************************************************/
-#define BLOCK_SIZE  4096        /* size of blocks */
+#ifndef BLOCK_SIZE
+#define BLOCK_SIZE  4096        /* size of blocks (may be set when building) */
+#endif
+#define ALPHABET_SIZE   (UCHAR_MAX + 1)     /* number of distinct symbols */
+#define NUM_PAIRS   (ALPHABET_SIZE * ALPHABET_SIZE)     /* symbol pairs */
+#define INSERTION_SORT_SIZE 16      /* largest range insertion sorted */
+
+#define DECODE_INTERLEAVE   4       /* blocks reverse transformed together */
 
-#if BLOCK_SIZE > INT_MAX
-#error BLOCK_SIZE must be <= INT_MAX and maximum size_t
+#define RLE_RUN_LENGTH  4           /* run length that is followed by count */
+#define RLE_MAX_COUNT   UCHAR_MAX   /* maximum additional repeats in count */
+
+#define CRC_SIZE        4           /* bytes of CRC following each block */
+#define CRC_POLYNOMIAL  0x82F63B78UL    /* reversed CRC-32C (Castagnoli) */
+
+#if BLOCK_SIZE > (INT_MAX / 2)
+#error BLOCK_SIZE must be <= INT_MAX / 2 and maximum size_t
 #endif
 
 /* NOTE: Need to find a way to check for maximum size_t */
@@ -57,392 +74,640 @@
 /***************************************************************************
 *                            TYPE DEFINITIONS
 ***************************************************************************/
+/* run length coding state carried from block to block */
+typedef struct
+{
+    int last;           /* last character read or written */
+    int runLength;      /* number of times last has been repeated */
+} rle_state_t;
+
+/* the parts of a transformed block that precede and follow L */
+typedef struct
+{
+    int s0Idx;                  /* index of S0 in rotations (I) */
+    size_t length;              /* number of characters in L */
+    unsigned long crc;          /* CRC-32C following L (XFORM_WITH_CRC) */
+} block_header_t;
+
+/* the characters that appear in a block */
+typedef struct
+{
+    unsigned int size;                      /* number of distinct characters */
+    unsigned int count[ALPHABET_SIZE];      /* count[c] = # of c in block */
+    unsigned int rank[ALPHABET_SIZE];       /* rank[c] = index of c in symbol */
+    unsigned char symbol[ALPHABET_SIZE];    /* characters in increasing order */
+} alphabet_t;
+
+/* tables for computing CRC-32C four bytes at a time (slicing by 4) */
+typedef struct
+{
+    unsigned long entry[4][ALPHABET_SIZE];
+} crc_table_t;
+
+/* narrowest type able to index every position in a block */
+#if BLOCK_SIZE <= (USHRT_MAX + 1)
+typedef unsigned short index_t;
+#else
+typedef unsigned int index_t;
+#endif
+
+/***************************************************************************
+* Each transform's work areas are grouped into one structure, so they come
+* from a single allocation.  A single region is simpler for an allocator
+* (see BWSetAllocator) to back with huge pages or place on a NUMA node.
+*
+* Transforming takes 1.5 index_t and 3 characters of work area for each
+* character of BLOCK_SIZE (6 bytes with 2 byte index_t, 9 with 4 byte
+* index_t), plus the NUM_PAIRS + 1 unsigned ints of pairStart.
+* mergeBuffer is rounded up so that it isn't empty when BLOCK_SIZE is 1.
+***************************************************************************/
+/* work areas for transforming */
+typedef struct
+{
+    unsigned int pairStart[NUM_PAIRS + 1];  /* first rotation with a pair */
+    index_t rotationIdx[BLOCK_SIZE];        /* first char of each rotation */
+    index_t mergeBuffer[(BLOCK_SIZE + 1) / 2];  /* for SortRotations */
+    unsigned char block[2 * BLOCK_SIZE];    /* block followed by a copy */
+    unsigned char last[BLOCK_SIZE + CRC_SIZE];  /* L of block appended to */
+} xform_work_t;
+
+/* work areas for reverse transforming DECODE_INTERLEAVE blocks at once */
+typedef struct
+{
+    index_t lf[DECODE_INTERLEAVE * BLOCK_SIZE];     /* LF mapping of blocks */
+    unsigned char last[DECODE_INTERLEAVE * BLOCK_SIZE + CRC_SIZE];  /* L */
+    unsigned char unrotated[DECODE_INTERLEAVE * BLOCK_SIZE];    /* blocks */
+} reverse_work_t;
+
+/* stream being reverse transformed a block at a time (see BWDecoderOpen) */
+struct bwt_decoder_t
+{
+    FILE *fpIn;                 /* transformed stream */
+    xform_t method;             /* method fpIn was transformed with */
+    index_t lf[BLOCK_SIZE];     /* lf[i] = row of rotation ending at row i */
+    unsigned char last[BLOCK_SIZE + CRC_SIZE];  /* L followed by its CRC */
+    unsigned char unrotated[BLOCK_SIZE];        /* most recently decoded */
+    size_t length;              /* number of characters in unrotated */
+    size_t next;                /* next character of unrotated to return */
+    rle_state_t rleState;       /* run length decoding of output */
+    int repeats;                /* copies of rleState.last to return */
+    int ended;                  /* the final (short) block has been read */
+    int failed;                 /* a block couldn't be decoded */
+    crc_table_t crcTable;       /* used if method has XFORM_WITH_CRC */
+};
+
+#ifdef BWT_PROFILE
+/* transform stages timed when built with BWT_PROFILE defined */
+typedef enum
+{
+    STAGE_RADIX = 0,        /* radix sort on first two characters */
+    STAGE_BUCKET_SORT,      /* sort of rotations with matching pairs */
+    STAGE_MTF,              /* move to front encoding */
+    STAGE_UNDO_MTF,         /* move to front decoding */
+    STAGE_LF_WALK,          /* reverse transform count and LF walk */
+    NUM_STAGES
+} stage_t;
+#endif
 
 /***************************************************************************
 *                            GLOBAL VARIABLES
 ***************************************************************************/
-static unsigned char block[BLOCK_SIZE];     /* block being (un)transformed */
-static size_t blockSize;                    /* actual size of block */
+/* allocator for work areas (see BWSetAllocator) */
+static bwt_allocator_t allocator = {NULL, NULL, NULL};
+
+#ifdef BWT_PROFILE
+static clock_t stageStart;                  /* start of stage being timed */
+static clock_t stageTime[NUM_STAGES];       /* accumulated stage times */
+#endif
 
 /***************************************************************************
 *                                 MACROS
 ***************************************************************************/
-/* wraps array index within array bounds (assumes value < 2 * limit) */
-#define Wrap(value, limit)      (((value) < (limit)) ? (value) : ((value) - (limit)))
+/* bucket of rotations starting with characters ranked r1 r2 (of n ranks) */
+#define PairIndex(r1, r2, n)    (((r1) * (n)) + (r2))
+
+/* accumulate time spent in each stage when built with BWT_PROFILE */
+#ifdef BWT_PROFILE
+#define ProfileStart()          (stageStart = clock())
+#define ProfileStop(stage)      (stageTime[(stage)] += clock() - stageStart)
+#else
+#define ProfileStart()
+#define ProfileStop(stage)
+#endif
 
 /***************************************************************************
 *                               PROTOTYPES
 ***************************************************************************/
+/* memory functions */
+static void *Allocate(const size_t size);
+static void Release(void *ptr, const size_t size);
+
+/* transform functions */
+static int XformStream(FILE *fpIn, FILE *fpOut, const xform_t method,
+    xform_work_t *const work, size_t prefixLength);
+
+/* sorting functions */
+static int ComparePresorted(const unsigned char *const block,
+    const size_t blockSize, const unsigned int s1, const unsigned int s2);
+static void SortRotations(index_t *const rotationIdx, const size_t count,
+    index_t *const buffer, const unsigned char *const block,
+    const size_t blockSize);
+static void CountCharacters(const unsigned char *const data,
+    const size_t length, unsigned int *const count);
+static void SortPairBuckets(index_t *const rotationIdx,
+    const unsigned int *const pairStart, const alphabet_t *const alphabet,
+    index_t *const buffer, const unsigned char *const block,
+    const size_t blockSize);
+
+/* run length coding functions */
+static size_t ReadRLEBlock(FILE *fpIn, unsigned char *const block,
+    rle_state_t *const state);
+static int RLEGetc(FILE *fpIn, rle_state_t *const state);
+static void WriteRLEBlock(const unsigned char *const data, const size_t length,
+    FILE *fpOut, rle_state_t *const state);
+static int RLERepeats(const unsigned char c, rle_state_t *const state);
+
+/* reverse transform functions */
+static int ReadBlock(FILE *fpIn, const xform_t method,
+    unsigned char *const last, block_header_t *const header);
+static unsigned int DecodeBlocks(unsigned char *const last,
+    index_t *const lf, unsigned char *const unrotated,
+    const block_header_t *const header, const unsigned int numBlocks,
+    const xform_t method, const crc_table_t *const crcTable);
+static int DecodeNextBlock(bwt_decoder_t *const decoder);
+static void BuildLF(const unsigned char *const last, const size_t length,
+    index_t *const lf);
+
+/* block checksum functions */
+static void BuildCRCTable(crc_table_t *const table);
+static unsigned long CRC32C(const crc_table_t *const table,
+    const unsigned char *const data, const size_t length);
+static void WriteCRC(const unsigned long crc, FILE *fpOut);
+static unsigned long GetCRC(const unsigned char *const data);
+
 /* move to front functions */
-static int DoMTF(const unsigned char *const last, const int length);
-static int UndoMTF(unsigned char *const last, const int length);
+static void DoMTF(unsigned char *const last, const int length,
+    const xform_t method);
+static void UndoMTF(unsigned char *const last, const int length,
+    const xform_t method);
+static void UpdateMTFList(unsigned char *const list, const int position,
+    const int prevPosition, const xform_t method);
+
+#ifdef BWT_PROFILE
+static void ReportProfile(const char *const label, const unsigned long bytes);
+#endif
 
 /***************************************************************************
 *                                FUNCTIONS
 ***************************************************************************/
 
+/***************************************************************************
+*   Function   : BWSetAllocator
+*   Description: This function sets the functions used to allocate and
+*                release the library's work areas, so that callers can
+*                provide them from their own memory pools.
+*   Parameters : newAllocator - the allocate and release functions to
+*                               use, or NULL to use malloc and free.
+*   Effects    : Subsequent work areas come from the specified allocator.
+*   Returned   : NONE
+***************************************************************************/
+void BWSetAllocator(const bwt_allocator_t *const newAllocator)
+{
+    if ((NULL == newAllocator) || (NULL == newAllocator->allocate) ||
+        (NULL == newAllocator->release))
+    {
+        /* use malloc and free */
+        allocator.allocate = NULL;
+        allocator.release = NULL;
+        allocator.context = NULL;
+    }
+    else
+    {
+        allocator = *newAllocator;
+    }
+}
+
+/***************************************************************************
+*   Function   : Allocate
+*   Description: This function allocates a work area using the allocator
+*                set by BWSetAllocator, or malloc if there isn't one.
+*   Parameters : size - the number of bytes to allocate
+*   Effects    : Memory is allocated.
+*   Returned   : Pointer to the allocated memory or NULL on failure.
+***************************************************************************/
+static void *Allocate(const size_t size)
+{
+    void *ptr;
+
+    if (NULL == allocator.allocate)
+    {
+        return malloc(size);
+    }
+
+    ptr = allocator.allocate(size, allocator.context);
+
+#ifdef ENOMEM
+    if ((NULL == ptr) && (0 == errno))
+    {
+        /* callers report errno */
+        errno = ENOMEM;
+    }
+#endif
+
+    return ptr;
+}
+
+/***************************************************************************
+*   Function   : Release
+*   Description: This function releases a work area obtained from
+*                Allocate.
+*   Parameters : ptr - the memory to release
+*                size - the number of bytes that were allocated
+*   Effects    : Memory is released.
+*   Returned   : NONE
+***************************************************************************/
+static void Release(void *ptr, const size_t size)
+{
+    if (NULL == allocator.release)
+    {
+        free(ptr);
+    }
+    else
+    {
+        allocator.release(ptr, size, allocator.context);
+    }
+}
+
 /***************************************************************************
 *   Function   : ComparePresorted
-*   Description: This comparison function is designed for use with qsort
-*                and "block", a global array of "blockSize" unsigned chars.
-*                It compares two strings in "block" starting at indices
-*                s1 and s2 and ending at indices s1 - 1 and s2 - 1.
-*                The strings are assumed to be presorted so that first two
-*                characters are known to be matching.
-*   Parameters : s1 - The starting index of a string in block
+*   Description: This function compares two rotations of "block", an array
+*                of "blockSize" unsigned chars followed by a copy of
+*                itself.  It compares the strings in "block" starting at
+*                indices s1 and s2 and ending at indices s1 - 1 and s2 - 1
+*                (wrapping around the block).  The strings are assumed to
+*                be presorted so that first two characters are known to be
+*                matching.
+*   Parameters : block - the block followed by a copy of itself
+*                blockSize - the number of characters in the block
+*                s1 - The starting index of a string in block
 *                s2 - The starting index of a string in block
 *   Effects    : NONE
 *   Returned   : > 0 if string s1 > string s2
 *                0 if string s1 == string s2
 *                < 0 if string s1 < string s2
 ***************************************************************************/
-static int ComparePresorted(const void *s1, const void *s2)
+static int ComparePresorted(const unsigned char *const block,
+    const size_t blockSize, const unsigned int s1, const unsigned int s2)
 {
-    unsigned int offset1, offset2;
-    unsigned int i;
-
     /***********************************************************************
-    * Compare 1 character at a time until there's difference or the end of
-    * the block is reached.  Since we're only sorting strings that already
-    * match at the first two characters, start with the third character.
+    * Since we're only sorting strings that already match at the first two
+    * characters, start with the third character.  block holds two copies
+    * of the block, so each rotation is a contiguous string and memcmp can
+    * compare them many bytes at a time.
     ***********************************************************************/
-    offset1 = *((unsigned int *)s1) + 2;
-    offset2 = *((unsigned int *)s2) + 2;
+    return memcmp(&block[s1 + 2], &block[s2 + 2], blockSize - 2);
+}
 
-    for(i = 2; i < blockSize; i++)
-    {
-        unsigned char c1, c2;
+/***************************************************************************
+*   Function   : SortRotations
+*   Description: This function merge sorts rotations of "block" that match
+*                at their first two characters.  It replaces qsort, whose
+*                comparison function can't be told which block to use
+*                without a global variable.  Comparing rotations with
+*                long common prefixes is expensive, so a merge sort is used
+*                for its small number of comparisons.  Short ranges are
+*                insertion sorted, and halves that are already in order
+*                aren't merged.
+*   Parameters : rotationIdx - the rotations to sort
+*                count - the number of rotations in rotationIdx
+*                buffer - room for count / 2 rotations
+*                block - the block followed by a copy of itself
+*                blockSize - the number of characters in the block
+*   Effects    : rotationIdx is sorted.
+*   Returned   : NONE
+***************************************************************************/
+static void SortRotations(index_t *const rotationIdx, const size_t count,
+    index_t *const buffer, const unsigned char *const block,
+    const size_t blockSize)
+{
+    size_t half, i, j, k;
+    index_t tmp;
 
-        /* ensure that offsets are properly bounded */
-        if (offset1 >= blockSize)
+    if (count <= INSERTION_SORT_SIZE)
+    {
+        for (i = 1; i < count; i++)
         {
-            offset1 -= blockSize;
-        }
+            tmp = rotationIdx[i];
 
-        if (offset2 >= blockSize)
-        {
-            offset2 -= blockSize;
+            for (j = i; j > 0; j--)
+            {
+                if (ComparePresorted(block, blockSize, rotationIdx[j - 1],
+                    tmp) <= 0)
+                {
+                    break;
+                }
+
+                rotationIdx[j] = rotationIdx[j - 1];
+            }
+
+            rotationIdx[j] = tmp;
         }
 
-        c1 = block[offset1];
-        c2 = block[offset2];
+        return;
+    }
+
+    half = count / 2;
+    SortRotations(rotationIdx, half, buffer, block, blockSize);
+    SortRotations(&rotationIdx[half], count - half, buffer, block,
+        blockSize);
+
+    if (ComparePresorted(block, blockSize, rotationIdx[half - 1],
+        rotationIdx[half]) <= 0)
+    {
+        /* the halves are already in order */
+        return;
+    }
 
-        if (c1 > c2)
+    /* merge the first half (moved to buffer) with the second half */
+    memcpy(buffer, rotationIdx, half * sizeof(index_t));
+    i = 0;
+    j = half;
+    k = 0;
+
+    while ((i < half) && (j < count))
+    {
+        if (ComparePresorted(block, blockSize, rotationIdx[j],
+            buffer[i]) < 0)
         {
-            return 1;
+            rotationIdx[k] = rotationIdx[j];
+            j++;
         }
-        else if (c2 > c1)
+        else
         {
-            return -1;
+            rotationIdx[k] = buffer[i];
+            i++;
         }
 
-        /* strings match to here, try next character */
-        offset1++;
-        offset2++;
+        k++;
     }
 
-    /* strings are identical */
-    return 0;
+    /* anything left in the second half is already in place */
+    memcpy(&rotationIdx[k], &buffer[i], (half - i) * sizeof(index_t));
 }
 
 /***************************************************************************
-*   Function   : BWXform
-*   Description: This function performs a Burrows-Wheeler transformation
-*                on a file (with optional move to front) and writes the
-*                resulting data to the specified output file.  Comments in
-*                this function indicate corresponding variables, labels,
-*                and sections in "A Block-sorting Lossless Data Compression
-*                Algorithm" by M. Burrows and D.J. Wheeler.
-*   Parameters : fpIn - FILE pointer to file to transform
-*                fpOut - FILE pointer to file to write transformed output
-*                method - Set to XFORM_WITH_MTF if move to front coding
-*                      should be applied.
-*   Effects    : A Burrows-Wheeler transformation (and possibly move to
-*                front encoding) is applied to fpIn.   The results of
-*                the transformation are written to fpOut.
-*   Returned   : Zero for success, otherwise non-zero.
+*   Function   : CountCharacters
+*   Description: This function counts the number of times each character
+*                appears in an array.  Four sets of counters are used for
+*                interleaved characters, so that runs of matching
+*                characters don't make each increment wait on the one
+*                before it, then the sets are summed.
+*   Parameters : data - array of characters to count
+*                length - the number of unsigned chars contained in data.
+*                count - ALPHABET_SIZE counters receiving the counts
+*   Effects    : count[c] is set to the number of times c is in data.
+*   Returned   : NONE
 ***************************************************************************/
-int BWXform(FILE *fpIn, FILE *fpOut, const xform_t method)
+static void CountCharacters(const unsigned char *const data,
+    const size_t length, unsigned int *const count)
 {
-    unsigned int i, j, k;
-    unsigned int *rotationIdx;      /* index of first char in rotation */
-    unsigned int *v;                /* index of radix sorted charaters */
-    int s0Idx;                      /* index of S0 in rotations (I) */
-    unsigned char *last;            /* last characters from sorted rotations */
+    unsigned int partial[4][ALPHABET_SIZE];     /* interleaved counters */
+    size_t i;
+    unsigned int c;
 
-    /* counters and offsets used for radix sorting with characters */
-    unsigned int counters[256];
-    unsigned int offsetTable[256];
+    memset(partial, 0, sizeof(partial));
 
-    if ((NULL == fpIn) || (NULL == fpOut))
+    for (i = 0; i + 3 < length; i += 4)
     {
-        fprintf(stderr, "Invalid File Pointer Arguments\n");
-        return -1;
+        partial[0][data[i]]++;
+        partial[1][data[i + 1]]++;
+        partial[2][data[i + 2]]++;
+        partial[3][data[i + 3]]++;
     }
 
-    /***********************************************************************
-    * BLOCK_SIZE arrays are allocated on the heap, because gcc generates
-    * code that throws a Segmentation fault when the large arrays are
-    * allocated on the stack.
-    ***********************************************************************/
-    rotationIdx = (unsigned int *)malloc(BLOCK_SIZE * sizeof(unsigned int));
-
-    if (NULL == rotationIdx)
+    /* count what's left over */
+    for (; i < length; i++)
     {
-        perror("Allocating array of rotation indices");
-        return errno;
+        partial[0][data[i]]++;
     }
 
-    v = (unsigned int *)malloc(BLOCK_SIZE * sizeof(unsigned int));
-
-    if (v == rotationIdx)
+    for (c = 0; c < ALPHABET_SIZE; c++)
     {
-        perror("Allocating array of sort indices");
-        free(rotationIdx);
-        return errno;
+        count[c] = partial[0][c] + partial[1][c] + partial[2][c] +
+            partial[3][c];
     }
+}
 
-    last = (unsigned char *)malloc(BLOCK_SIZE * sizeof(unsigned char));
-
-    if (NULL == last)
-    {
-        perror("Allocating array of last characters");
-        free(rotationIdx);
-        free(v);
-        return errno;
-    }
+/***************************************************************************
+*   Function   : SortPairBuckets
+*   Description: This function completes the sort of rotations in "block"
+*                that have already been radix sorted on their first two
+*                characters.  It uses Julian Seward's copying method from
+*                bzip2.  The buckets of rotations starting with the same
+*                character are handled smallest first.  Pairs ss j in the
+*                current bucket ss that haven't already been derived are
+*                sorted.  A single pass over the bucket then yields
+*                the order of every pair bucket c ss, including ss ss,
+*                because rotations starting with c ss are ordered the same
+*                as the rotations starting with ss that follow them.
+*   Parameters : rotationIdx - rotations sorted on their first two
+*                              characters.
+*                pairStart - pairStart[PairIndex(r1, r2, n)] is the index
+*                            of the first rotation starting with the
+*                            characters ranked r1 r2 in alphabet.
+*                alphabet - the characters in the block.
+*                buffer - room for BLOCK_SIZE / 2 rotations
+*                block - the block followed by a copy of itself
+*                blockSize - the number of characters in the block
+*   Effects    : rotationIdx is fully sorted.
+*   Returned   : NONE
+***************************************************************************/
+static void SortPairBuckets(index_t *const rotationIdx,
+    const unsigned int *const pairStart, const alphabet_t *const alphabet,
+    index_t *const buffer, const unsigned char *const block,
+    const size_t blockSize)
+{
+    const unsigned int n = alphabet->size;
+    unsigned int order[ALPHABET_SIZE];      /* ranks by increasing bucket */
+    unsigned int copyStart[ALPHABET_SIZE];  /* next slot from front of c ss */
+    unsigned int copyEnd[ALPHABET_SIZE];    /* last slot filled in c ss */
+    char done[ALPHABET_SIZE];               /* bucket is completely sorted */
+    unsigned int i, j, k;
 
-    while((blockSize = fread(block, sizeof(unsigned char), BLOCK_SIZE, fpIn))
-        != 0)
+    /* order first character buckets from smallest to largest */
+    for (i = 0; i < n; i++)
     {
-        /*******************************************************************
-        * Sort the rotated strings in the block.  A radix sort is performed
-        * on the first to characters of all the rotated strings (2nd
-        * character then 1st).  All rotated strings with matching initial
-        * characters are then quicksorted. - Q4..Q7
-        *******************************************************************/
-
-        /*** radix sort on second character in rotation ***/
+        const unsigned int size = alphabet->count[alphabet->symbol[i]];
 
-        /* count number of characters for radix sort */
-        memset(counters, 0, 256 * sizeof(int));
-        for (i = 0; i < blockSize; i++)
+        for (j = i; j > 0; j--)
         {
-            counters[block[i]]++;
-        }
-
-        offsetTable[0] = 0;
+            if (alphabet->count[alphabet->symbol[order[j - 1]]] <= size)
+            {
+                break;
+            }
 
-        for(i = 1; i < 256; i++)
-        {
-            /* determine number of values before those sorted under i */
-            offsetTable[i] = offsetTable[i - 1] + counters[i - 1];
+            order[j] = order[j - 1];
         }
 
-        /* sort on 2nd character */
-        for (i = 0; i < blockSize - 1; i++)
-        {
-            j = block[i + 1];
-            v[offsetTable[j]] = i;
-            offsetTable[j] = offsetTable[j] + 1;
-        }
+        order[j] = i;
+        done[alphabet->symbol[i]] = 0;
+    }
 
-        /* handle wrap around for string starting at end of block */
-        j = block[0];
-        v[offsetTable[j]] = i;
-        offsetTable[0] = 0;
+    for (i = 0; i < n; i++)
+    {
+        const unsigned int r = order[i];
+        const unsigned char ss = alphabet->symbol[r];
+        unsigned int first, end, pairEnd;
 
-        /*** radix sort on first character in rotation ***/
+        /* sort pair buckets ss j that won't be or weren't copied */
+        first = pairStart[PairIndex(r, 0, n)];
+        end = pairStart[PairIndex(r + 1, 0, n)];
 
-        for(i = 1; i < 256; i++)
+        for (k = first; k < end; k = pairEnd)
         {
-            /* determine number of values before those sorted under i */
-            offsetTable[i] = offsetTable[i - 1] + counters[i - 1];
-        }
+            /* step through the non-empty pair buckets ss j */
+            j = block[rotationIdx[k] + 1];
+            pairEnd = pairStart[PairIndex(r, alphabet->rank[j], n) + 1];
 
-        for (i = 0; i < blockSize; i++)
-        {
-            j = v[i];
-            j = block[j];
-            rotationIdx[offsetTable[j]] = v[i];
-            offsetTable[j] = offsetTable[j] + 1;
+            if (done[j] || (j == ss))
+            {
+                /* ss j was or will be copied in order */
+                continue;
+            }
+
+            if (pairEnd - k > 1)
+            {
+                /* there are at least 2 strings starting with ss j */
+                SortRotations(&rotationIdx[k], pairEnd - k, buffer, block,
+                    blockSize);
+            }
         }
 
         /*******************************************************************
-        * now rotationIdx contains the sort order of all strings sorted
-        * by their first 2 characters.  Use qsort to sort the strings
-        * that have their first two characters matching.
+        * Every bucket ss j except ss ss is now sorted.  Scanning bucket ss
+        * in order and placing the rotation preceding each one into the
+        * c ss bucket (c being the preceding character) places every c ss
+        * bucket in sorted order.  Rotations before ss ss fill the c ss
+        * buckets from the front, and rotations after ss ss fill them from
+        * the back.  ss ss gets filled as it is scanned, because its
+        * rotations are preceded by rotations starting with ss ss.
         *******************************************************************/
-        for (i = 0, k = 0; (i <= UCHAR_MAX) && (k < (blockSize - 1)); i++)
+        for (j = 0; j < n; j++)
         {
-            for (j = 0; (j <= UCHAR_MAX) && (k < (blockSize - 1)); j++)
-            {
-                unsigned int first = k;
-
-                /* count strings starting with ij */
-                while ((i == block[rotationIdx[k]]) &&
-                    (j == block[Wrap(rotationIdx[k] + 1,  blockSize)]))
-                {
-                    k++;
-
-                    if (k == blockSize)
-                    {
-                        /* we've searched the whole block */
-                        break;
-                    }
-                }
+            const unsigned char c = alphabet->symbol[j];
 
-                if (k - first > 1)
-                {
-                    /* there are at least 2 strings staring with ij, sort them */
-                    qsort(&rotationIdx[first], k - first, sizeof(int),
-                        ComparePresorted);
-                }
-            }
+            copyStart[c] = pairStart[PairIndex(j, r, n)];
+            copyEnd[c] = pairStart[PairIndex(j, r, n) + 1];
         }
 
-        /* find last characters of rotations (L) - C2 */
-        s0Idx = 0;
-        for (i = 0; i < blockSize; i++)
+        for (k = first; k < copyStart[ss]; k++)
         {
-            if (rotationIdx[i] != 0)
-            {
-                last[i] = block[rotationIdx[i] - 1];
-            }
-            else
+            unsigned int prev;
+            unsigned char c;
+
+            prev = (0 == rotationIdx[k]) ?
+                blockSize - 1 : rotationIdx[k] - 1U;
+            c = block[prev];
+
+            if (!done[c])
             {
-                /* unrotated string 1st character is end of string */
-                s0Idx = i;
-                last[i] = block[blockSize - 1];
+                rotationIdx[copyStart[c]] = prev;
+                copyStart[c]++;
             }
         }
 
-        if (XFORM_WITH_MTF == method)
+        for (k = end; k > copyEnd[ss]; k--)
         {
-            int ret;
+            unsigned int prev;
+            unsigned char c;
 
-            ret = DoMTF(last, blockSize);
+            prev = (0 == rotationIdx[k - 1]) ?
+                blockSize - 1 : rotationIdx[k - 1] - 1U;
+            c = block[prev];
 
-            if (ret)
+            if (!done[c])
             {
-                free(rotationIdx);
-                free(v);
-                free(last);
-                return errno;
+                copyEnd[c]--;
+                rotationIdx[copyEnd[c]] = prev;
             }
         }
 
-        /* write index of end of unrotated string (I) */
-        fwrite(&s0Idx, sizeof(int), 1, fpOut);
-
-        /* write out last characters of rotations (L) */
-        fwrite(last, sizeof(unsigned char), blockSize, fpOut);
+        done[ss] = 1;
     }
-
-    /* clean up */
-    free(rotationIdx);
-    free(v);
-    free(last);
-    return 0;
 }
 
 /***************************************************************************
-*   Function   : DoMTF
-*   Description: This function performs move to front encoding on a block
-*                on of data that has already had the Burrows-Wheeler
-*                transformation applied to it.  Comments in this function
-*                indicate corresponding variables, labels, and sections in
-*                "A Block-sorting Lossless Data Compression Algorithm" by
-*                M. Burrows and D.J. Wheeler.
-*   Parameters : last - pointer an array of "last" characters from
-*                       Burrows-Wheeler rotations (L)
-*                length - the number of unsigned chars contained in last.
-*   Effects    : Move to front encoding is applied on an array of last
-*                characters.  The results of the encoding replace the data
-*                that was stored in last.
+*   Function   : BWXform
+*   Description: This function performs a Burrows-Wheeler transformation
+*                on a file (with optional move to front) and writes the
+*                resulting data to the specified output file.  Comments in
+*                this function indicate corresponding variables, labels,
+*                and sections in "A Block-sorting Lossless Data Compression
+*                Algorithm" by M. Burrows and D.J. Wheeler.
+*   Parameters : fpIn - FILE pointer to file to transform
+*                fpOut - FILE pointer to file to write transformed output
+*                method - Set to XFORM_WITH_MTF, XFORM_WITH_MTF1, or
+*                      XFORM_WITH_MTF2 if move to front coding should be
+*                      applied.  OR with XFORM_WITH_RLE to run length encode
+*                      fpIn before it is transformed, and XFORM_WITH_CRC to
+*                      follow each block with a CRC-32C of its data.
+*   Effects    : A Burrows-Wheeler transformation (and possibly move to
+*                front encoding) is applied to fpIn.   The results of
+*                the transformation are written to fpOut.
 *   Returned   : Zero for success, otherwise non-zero.
 ***************************************************************************/
-static int DoMTF(const unsigned char *const last, const int length)
+int BWXform(FILE *fpIn, FILE *fpOut, const xform_t method)
 {
-    unsigned char list[UCHAR_MAX + 1];      /* list of characters (Y) */
-    unsigned char *encoded;                 /* mtf encoded block (R) */
-    int i, j;
-
-    /***********************************************************************
-    * BLOCK_SIZE arrays are allocated on the heap, because gcc generates
-    * code that throws a Segmentation fault when the large arrays are
-    * allocated on the stack.
-    ***********************************************************************/
-    encoded = (unsigned char *)malloc(length * sizeof(unsigned char));
+    xform_work_t *work;             /* work areas for the transform */
+    int result;
 
-    if (NULL == encoded)
+    if ((NULL == fpIn) || (NULL == fpOut))
     {
-        perror("Allocating array to store MTF encoding");
-        return errno;
+        fprintf(stderr, "Invalid File Pointer Arguments\n");
+        return -1;
     }
 
-    /* start with alphabetically sorted list of characters */
-    for(i = 0; i <= UCHAR_MAX; i++)
-    {
-        list[i] = (unsigned char)i;
-    }
+    work = (xform_work_t *)Allocate(sizeof(xform_work_t));
 
-    /* move-to-front coding - M1 */
-    for (i = 0; i < length; i++)
+    if (NULL == work)
     {
-        /*******************************************************************
-        * Find the character in the list of characters.  I do a sequential
-        * search because move to front causes common characters to be
-        * near the front of the list.
-        *******************************************************************/
-        for (j = 0; j <= UCHAR_MAX; j++)
-        {
-            if (list[j] == last[i])
-            {
-                /* we found the character */
-                encoded[i] = j;
-                break;
-            }
-        }
-
-        /* now move the current character to the front of the list */
-        memmove(&(list[1]), list, j);
-        list[0] = last[i];
+        perror("Allocating transform work areas");
+        return errno;
     }
 
-    /* copy mtf encoded vector of last characters (R) to input */
-    memcpy((void *)last, (void *)encoded, sizeof(unsigned char) * length);
-    free(encoded);
-
-    return 0;
+    result = XformStream(fpIn, fpOut, method, work, 0);
+    Release(work, sizeof(xform_work_t));
+    return result;
 }
 
 /***************************************************************************
-*   Function   : BWReverseXformFile
-*   Description: This function reverses a Burrows-Wheeler transformation
-*                on a file (with optional move to front) and writes the
-*                resulting data to the specified output file.  Comments in
-*                this function indicate corresponding variables, labels,
-*                and sections in "A Block-sorting Lossless Data Compression
-*                Algorithm" by M. Burrows and D.J. Wheeler.
-*   Parameters : fpIn - FILE pointer to file to reverse transform
-*                fpOut - FILE pointer to file to write reverse transformed
-*                          output to
-*                method - Set to XFORM_WITH_MTF if move to front coding
-*                      should be applied.
-*   Effects    : A Burrows-Wheeler reverse transformation (and possibly
-*                move to front encoding) is applied to fpIn.   The results
-*                of the reverse transformation are written to fpOut.
+*   Function   : BWXformAppend
+*   Description: This function appends the Burrows-Wheeler transformation
+*                of a file to an existing transformed stream.  If the
+*                stream ends with a partial block, that block is reverse
+*                transformed and transformed again with the start of the
+*                new data, so only the final block of the existing stream
+*                is rewritten.
+*   Parameters : fpIn - FILE pointer to file to transform
+*                fpOut - FILE pointer to transformed stream to append to.
+*                        It must be open for reading and writing.
+*                method - The method the stream was transformed with.
+*                      Streams transformed with XFORM_WITH_RLE can't be
+*                      appended to.
+*   Effects    : The Burrows-Wheeler transformation of fpIn is appended to
+*                the transformed stream fpOut.
 *   Returned   : Zero for success, otherwise non-zero.
 ***************************************************************************/
-int BWReverseXform(FILE *fpIn, FILE *fpOut, const xform_t method)
+int BWXformAppend(FILE *fpIn, FILE *fpOut, const xform_t method)
 {
-    unsigned int i, j, sum;
-    int count[UCHAR_MAX + 1];   /* count[i] = # of chars in block <= i */
-    int *pred;                  /* pred[i] = # of times block[i] appears in
-                                   block[0 .. i - 1] */
-    unsigned char *unrotated;   /* original block */
-    int s0Idx;                  /* index of S0 in rotations (I) */
+    long size;                      /* size of the existing stream */
+    long offset;                    /* offset of the final block */
+    size_t length;                  /* length of the final partial block */
+    block_header_t header;          /* I, size, and CRC of final block */
+    xform_work_t *work;             /* work areas for the transform */
+    size_t crcSize;                 /* bytes of CRC following each block */
+    crc_table_t crcTable;           /* used if method has XFORM_WITH_CRC */
+    int result;
 
     if ((NULL == fpIn) || (NULL == fpOut))
     {
@@ -450,148 +715,1336 @@ int BWReverseXform(FILE *fpIn, FILE *fpOut, const xform_t method)
         return -1;
     }
 
-    /***********************************************************************
-    * BLOCK_SIZE arrays are allocated on the heap, because gcc generates
-    * code that throws a Segmentation fault when the large arrays are
-    * allocated on the stack.
-    ***********************************************************************/
-    pred = (int *)malloc(BLOCK_SIZE * sizeof(int));
+    if (method & XFORM_WITH_RLE)
+    {
+        /* the run length coding state at the end of the stream is lost */
+        fprintf(stderr, "Can't append to run length encoded streams\n");
+        return -1;
+    }
 
-    if (NULL == pred)
+    if ((fseek(fpOut, 0, SEEK_END) != 0) || ((size = ftell(fpOut)) < 0))
     {
-        perror("Allocating array of matching predecessors");
+        perror("Finding end of transformed stream");
         return errno;
     }
 
-    unrotated = (unsigned char *)malloc(BLOCK_SIZE * sizeof(unsigned char));
+    /***********************************************************************
+    * Blocks are I followed by L and an optional CRC, and only the final
+    * block may be short.
+    ***********************************************************************/
+    crcSize = (method & XFORM_WITH_CRC) ? CRC_SIZE : 0;
+    offset = size - (size % (long)(sizeof(int) + BLOCK_SIZE + crcSize));
+    length = 0;
+
+    if ((offset != size) && (size - offset <= (long)(sizeof(int) + crcSize)))
+    {
+        fprintf(stderr, "Transformed stream is truncated\n");
+        return -1;
+    }
 
-    if (NULL == unrotated)
+    work = (xform_work_t *)Allocate(sizeof(xform_work_t));
+
+    if (NULL == work)
     {
-        perror("Allocating array to store unrotated block");
-        free(pred);
+        perror("Allocating transform work areas");
         return errno;
     }
 
-    while(fread(&s0Idx, sizeof(int), 1, fpIn) != 0)
+    if (offset != size)
+    {
+        if (fseek(fpOut, offset, SEEK_SET) != 0)
+        {
+            perror("Seeking final transformed block");
+            result = errno;
+            Release(work, sizeof(xform_work_t));
+            return result;
+        }
+
+        if (method & XFORM_WITH_CRC)
+        {
+            BuildCRCTable(&crcTable);
+        }
+
+        /*******************************************************************
+        * Reverse transform the partial final block into the start of the
+        * block to transform.  Its LF mapping goes in rotationIdx, which
+        * isn't used until the block is transformed again.
+        *******************************************************************/
+        if ((ReadBlock(fpOut, method, work->last, &header) != 1) ||
+            (DecodeBlocks(work->last, work->rotationIdx, work->block,
+            &header, 1, method, &crcTable) != 1))
+        {
+            Release(work, sizeof(xform_work_t));
+            return -1;
+        }
+
+        length = header.length;
+
+        /* the final block will be overwritten */
+        if (fseek(fpOut, offset, SEEK_SET) != 0)
+        {
+            perror("Seeking final transformed block");
+            result = errno;
+            Release(work, sizeof(xform_work_t));
+            return result;
+        }
+    }
+
+    result = XformStream(fpIn, fpOut, method, work, length);
+    Release(work, sizeof(xform_work_t));
+    return result;
+}
+
+/***************************************************************************
+*   Function   : XformStream
+*   Description: This function performs a Burrows-Wheeler transformation
+*                on a file (with optional move to front) and writes the
+*                resulting data to the specified output file.  Comments in
+*                this function indicate corresponding variables, labels,
+*                and sections in "A Block-sorting Lossless Data Compression
+*                Algorithm" by M. Burrows and D.J. Wheeler.
+*   Parameters : fpIn - FILE pointer to file to transform
+*                fpOut - FILE pointer to file to write transformed output
+*                method - Set to XFORM_WITH_MTF, XFORM_WITH_MTF1, or
+*                      XFORM_WITH_MTF2 if move to front coding should be
+*                      applied.  OR with XFORM_WITH_RLE to run length encode
+*                      fpIn before it is transformed, and XFORM_WITH_CRC to
+*                      follow each block with a CRC-32C of its data.
+*                work - work areas for the transform
+*                prefixLength - The number of characters already in block
+*                      that precede the data in fpIn.
+*   Effects    : A Burrows-Wheeler transformation (and possibly move to
+*                front encoding) is applied to fpIn.   The results of
+*                the transformation are written to fpOut.
+*   Returned   : Zero for success, otherwise non-zero.
+***************************************************************************/
+static int XformStream(FILE *fpIn, FILE *fpOut, const xform_t method,
+    xform_work_t *const work, size_t prefixLength)
+{
+    unsigned int i, j;
+    size_t blockSize;               /* actual size of block */
+    const xform_t mtf = (xform_t)(method & XFORM_MTF_MASK);
+    rle_state_t rleState;           /* run length coding of input */
+    unsigned char *const block = work->block;   /* doubled block */
+    index_t *const rotationIdx = work->rotationIdx;
+    int s0Idx;                      /* index of S0 in rotations (I) */
+    unsigned char *last;            /* last characters of sorted rotations */
+    size_t prevSize;                /* size of previously transformed block */
+    crc_table_t crcTable;           /* used if method has XFORM_WITH_CRC */
+    unsigned long crc;              /* CRC-32C of block */
+
+    /* counters and offsets used for radix sorting with characters */
+    alphabet_t alphabet;            /* characters in the block */
+    unsigned int numPairs;          /* number of possible character pairs */
+    unsigned int *const pairStart = work->pairStart;
+#ifdef BWT_PROFILE
+    unsigned long totalBytes = 0;
+#endif
+
+    /***********************************************************************
+    * The last characters of each rotation (L) replace rotationIdx as they
+    * are found.  last[i] only overlaps rotationIdx[0 .. i], which have
+    * already been used by then, so no separate array is needed.
+    ***********************************************************************/
+    last = (unsigned char *)rotationIdx;
+
+    rleState.last = EOF;
+    rleState.runLength = 0;
+    prevSize = 0;
+    s0Idx = 0;
+    crc = 0;
+
+    if (method & XFORM_WITH_CRC)
+    {
+        BuildCRCTable(&crcTable);
+    }
+
+    for (;;)
     {
-        blockSize = fread(block, sizeof(unsigned char), BLOCK_SIZE, fpIn);
+        if (method & XFORM_WITH_RLE)
+        {
+            blockSize = ReadRLEBlock(fpIn, block, &rleState);
+        }
+        else
+        {
+            /* the first block may already start with prefixLength chars */
+            blockSize = prefixLength + fread(&block[prefixLength],
+                sizeof(unsigned char), BLOCK_SIZE - prefixLength, fpIn);
+            prefixLength = 0;
+        }
 
-        if (XFORM_WITH_MTF == method)
+        if (0 == blockSize)
         {
-            int ret;
+            break;
+        }
 
-            ret = UndoMTF(block, blockSize);
+        /*******************************************************************
+        * The copy of the previous block that follows it is only replaced
+        * after this check.  If this block matches it (zero filled pages,
+        * padding, etc.), so do s0Idx, last, and crc, which still hold the
+        * previous block's transformation.
+        *******************************************************************/
+        if ((blockSize == prevSize) &&
+            (0 == memcmp(block, &block[prevSize], blockSize)))
+        {
+#ifdef BWT_PROFILE
+            totalBytes += blockSize;
+#endif
+            fwrite(&s0Idx, sizeof(int), 1, fpOut);
+            fwrite(last, sizeof(unsigned char), blockSize, fpOut);
 
-            if (ret)
+            if (method & XFORM_WITH_CRC)
             {
-                free(pred);
-                free(unrotated);
-                return ret;
+                WriteCRC(crc, fpOut);
             }
+
+            continue;
         }
 
-        /* code based on pseudo code from section 4.2 (D1 and D2) follows */
-        for(i = 0; i <= UCHAR_MAX; i++)
+        if (method & XFORM_WITH_CRC)
         {
-            count[i] = 0;
+            /* checksum the data the reverse transform will produce */
+            crc = CRC32C(&crcTable, block, blockSize);
         }
 
+        /* follow the block with a copy so rotations needn't wrap */
+        memcpy(&block[blockSize], block, blockSize);
+        prevSize = blockSize;
+
+#ifdef BWT_PROFILE
+        totalBytes += blockSize;
+#endif
+        ProfileStart();
+
+        /*******************************************************************
+        * Sort the rotated strings in the block.  A radix sort is performed
+        * on the first two characters of all the rotated strings.  All
+        * rotated strings with matching initial characters are then sorted
+        * by SortPairBuckets. - Q4..Q7
+        *******************************************************************/
+
+        /* count number of characters */
+        CountCharacters(block, blockSize, alphabet.count);
+
         /*******************************************************************
-        * Set pred[i] to the number of times block[i] appears in the
-        * substring block[0 .. i - 1].  As a useful side effect count[i]
-        * will be the number of times character i appears in block.
+        * Rank the characters that appear in the block, and only count
+        * pairs of those.  Blocks with small alphabets (DNA, digits, etc.)
+        * then use a small pair table instead of all ALPHABET_SIZE squared
+        * pairs.
         *******************************************************************/
+        alphabet.size = 0;
+        for (i = 0; i < ALPHABET_SIZE; i++)
+        {
+            if (alphabet.count[i] != 0)
+            {
+                alphabet.rank[i] = alphabet.size;
+                alphabet.symbol[alphabet.size] = (unsigned char)i;
+                alphabet.size++;
+            }
+        }
+
+        numPairs = alphabet.size * alphabet.size;
+
+        /* count character pairs (block[blockSize] is block[0]) */
+        memset(pairStart, 0, (numPairs + 1) * sizeof(unsigned int));
         for (i = 0; i < blockSize; i++)
         {
-            pred[i] = count[block[i]];
-            count[block[i]]++;
+            pairStart[PairIndex(alphabet.rank[block[i]],
+                alphabet.rank[block[i + 1]], alphabet.size)]++;
+        }
+
+        /* determine number of rotations sorted under and before each pair */
+        for (i = 1; i <= numPairs; i++)
+        {
+            pairStart[i] += pairStart[i - 1];
+        }
+
+        /*******************************************************************
+        * Sort on the first two characters.  Filling each pair's bucket
+        * from the back leaves pairStart[j] indexing the first rotation
+        * starting with pair j.
+        *******************************************************************/
+        for (i = blockSize; i > 0; i--)
+        {
+            j = PairIndex(alphabet.rank[block[i - 1]],
+                alphabet.rank[block[i]], alphabet.size);
+            pairStart[j]--;
+            rotationIdx[pairStart[j]] = i - 1;
         }
 
+        ProfileStop(STAGE_RADIX);
+        ProfileStart();
+
         /*******************************************************************
-        * Finally, set count[i] to the number of characters in block
-        * lexicographically less than i.
+        * now rotationIdx contains the sort order of all strings sorted
+        * by their first 2 characters.  Sort the strings that have their
+        * first two characters matching.
         *******************************************************************/
-        sum = 0;
-        for(i = 0; i <= UCHAR_MAX; i++)
+        SortPairBuckets(rotationIdx, pairStart, &alphabet, work->mergeBuffer,
+            block, blockSize);
+
+        ProfileStop(STAGE_BUCKET_SORT);
+
+        /* find last characters of rotations (L) - C2 */
+        s0Idx = 0;
+        for (i = 0; i < blockSize; i++)
         {
-            j = count[i];
-            count[i] = sum;
-            sum += j;
+            j = rotationIdx[i];
+
+            if (j != 0)
+            {
+                last[i] = block[j - 1];
+            }
+            else
+            {
+                /* unrotated string 1st character is end of string */
+                s0Idx = i;
+                last[i] = block[blockSize - 1];
+            }
         }
 
-        /* construct the initial unrotated string (S[0]) */
-        i = s0Idx;
-        for(j = blockSize; j > 0; j--)
+        if (XFORM_WITHOUT_MTF != mtf)
         {
-            unrotated[j - 1] = block[i];
-            i = pred[i] + count[block[i]];
+            ProfileStart();
+            DoMTF(last, blockSize, mtf);
+            ProfileStop(STAGE_MTF);
         }
 
-        fwrite(unrotated, sizeof(unsigned char), blockSize, fpOut);
+        /* write index of end of unrotated string (I) */
+        fwrite(&s0Idx, sizeof(int), 1, fpOut);
+
+        /* write out last characters of rotations (L) */
+        fwrite(last, sizeof(unsigned char), blockSize, fpOut);
+
+        if (method & XFORM_WITH_CRC)
+        {
+            WriteCRC(crc, fpOut);
+        }
     }
 
-    /* clean up */
-    free(pred);
-    free(unrotated);
+#ifdef BWT_PROFILE
+    ReportProfile("BWXform", totalBytes);
+#endif
+
     return 0;
 }
 
 /***************************************************************************
-*   Function   : UndoMTF
-*   Description: This function reverses move to front encoding on a block
+*   Function   : ReadRLEBlock
+*   Description: This function fills "block" with run length encoded data
+*                read from fpIn.  Runs of RLE_RUN_LENGTH or more matching
+*                characters are written as RLE_RUN_LENGTH characters
+*                followed by a count of the additional repeats (like the
+*                first run length coding stage of bzip2).  Long runs make
+*                for slow rotation comparisons, this keeps them short.
+*   Parameters : fpIn - FILE pointer to file being transformed
+*                block - BLOCK_SIZE characters to fill
+*                state - run length coding state from the previous block
+*   Effects    : Up to BLOCK_SIZE run length encoded characters are written
+*                to block and state is updated.  Runs may span blocks.
+*   Returned   : The number of characters written to block.
+***************************************************************************/
+static size_t ReadRLEBlock(FILE *fpIn, unsigned char *const block,
+    rle_state_t *const state)
+{
+    size_t length;
+    int c;
+
+    for (length = 0; length < BLOCK_SIZE; length++)
+    {
+        c = RLEGetc(fpIn, state);
+
+        if (EOF == c)
+        {
+            break;
+        }
+
+        block[length] = (unsigned char)c;
+    }
+
+    return length;
+}
+
+/***************************************************************************
+*   Function   : RLEGetc
+*   Description: This function returns the next run length encoded
+*                character read from fpIn.
+*   Parameters : fpIn - FILE pointer to file being transformed
+*                state - run length coding state
+*   Effects    : Characters are read from fpIn and state is updated.
+*   Returned   : The next run length encoded character or EOF.
+***************************************************************************/
+static int RLEGetc(FILE *fpIn, rle_state_t *const state)
+{
+    int c;
+
+    if (RLE_RUN_LENGTH == state->runLength)
+    {
+        int count;
+
+        /* count the repeats following a run */
+        for (count = 0; count < RLE_MAX_COUNT; count++)
+        {
+            c = getc(fpIn);
+
+            if (c != state->last)
+            {
+                if (c != EOF)
+                {
+                    ungetc(c, fpIn);
+                }
+
+                break;
+            }
+        }
+
+        state->runLength = 0;
+        return count;
+    }
+
+    c = getc(fpIn);
+
+    if (EOF == c)
+    {
+        return EOF;
+    }
+
+    if ((state->runLength > 0) && (c == state->last))
+    {
+        state->runLength++;
+    }
+    else
+    {
+        state->last = c;
+        state->runLength = 1;
+    }
+
+    return c;
+}
+
+/***************************************************************************
+*   Function   : WriteRLEBlock
+*   Description: This function reverses the run length encoding applied
+*                by ReadRLEBlock, writing the decoded data to fpOut.
+*   Parameters : data - run length encoded data
+*                length - the number of unsigned chars contained in data.
+*                fpOut - FILE pointer to file receiving decoded data
+*                state - run length decoding state from the previous block
+*   Effects    : Decoded data is written to fpOut and state is updated.
+*   Returned   : NONE
+***************************************************************************/
+static void WriteRLEBlock(const unsigned char *const data, const size_t length,
+    FILE *fpOut, rle_state_t *const state)
+{
+    size_t i;
+    int count;
+
+    for (i = 0; i < length; i++)
+    {
+        for (count = RLERepeats(data[i], state); count > 0; count--)
+        {
+            putc(state->last, fpOut);
+        }
+    }
+}
+
+/***************************************************************************
+*   Function   : RLERepeats
+*   Description: This function reverses the run length encoding of one
+*                character written by ReadRLEBlock.  It is shared by
+*                WriteRLEBlock and BWDecoderRead.
+*   Parameters : c - the next run length encoded character
+*                state - run length decoding state
+*   Effects    : state is updated, and state->last is the character that
+*                c decodes to.
+*   Returned   : The number of times state->last is decoded from c.  This
+*                is 1 unless c is a count of repeats following a run.
+***************************************************************************/
+static int RLERepeats(const unsigned char c, rle_state_t *const state)
+{
+    if (RLE_RUN_LENGTH == state->runLength)
+    {
+        /* c is a count of repeats of the last character */
+        state->runLength = 0;
+        return c;
+    }
+
+    if ((state->runLength > 0) && (c == state->last))
+    {
+        state->runLength++;
+    }
+    else
+    {
+        state->last = c;
+        state->runLength = 1;
+    }
+
+    return 1;
+}
+
+/***************************************************************************
+*   Function   : DoMTF
+*   Description: This function performs move to front encoding on a block
 *                on of data that has already had the Burrows-Wheeler
 *                transformation applied to it.  Comments in this function
 *                indicate corresponding variables, labels, and sections in
 *                "A Block-sorting Lossless Data Compression Algorithm" by
 *                M. Burrows and D.J. Wheeler.
-*   Parameters : last - pointer an array of mtf encoded characters from
-*                       Burrows-Wheeler rotations.
+*   Parameters : last - pointer an array of "last" characters from
+*                       Burrows-Wheeler rotations (L)
 *                length - the number of unsigned chars contained in last.
-*   Effects    : Move to front encoding is reversed on an array of last
-*                characters.  The results of the reversal are stored in
-*                the array last (L), providing an array of last characters
-*                of sorted rotations.
-*   Returned   : Zero for success, otherwise non-zero.
+*                method - the move to front variant to apply
+*   Effects    : Move to front encoding is applied on an array of last
+*                characters.  The results of the encoding replace the data
+*                that was stored in last.
+*   Returned   : NONE
 ***************************************************************************/
-static int UndoMTF(unsigned char *const last, const int length)
+static void DoMTF(unsigned char *const last, const int length,
+    const xform_t method)
 {
-    unsigned char list[UCHAR_MAX + 1];      /* list of characters (Y) */
-    unsigned char *encoded;                 /* mtf encoded block (R) */
-    int i;
+    unsigned char list[ALPHABET_SIZE];      /* list of characters (Y) */
+    int i, j;
+    int prev;                               /* previously encoded position */
+
+    /* start with alphabetically sorted list of characters */
+    for(i = 0; i < ALPHABET_SIZE; i++)
+    {
+        list[i] = (unsigned char)i;
+    }
+
+    prev = 0;
+
+    /* move-to-front coding - M1 */
+    for (i = 0; i < length; i++)
+    {
+        const unsigned char c = last[i];
+
+        /*******************************************************************
+        * Find the character in the list of characters.  I do a sequential
+        * search because move to front causes common characters to be
+        * near the front of the list.  memchr searches many characters at
+        * a time.  Every character is in the list, so it will be found.
+        *******************************************************************/
+        j = (unsigned char *)memchr(list, c, ALPHABET_SIZE) - list;
+
+        /* last[i] has been read, so its encoding (R) can replace it */
+        last[i] = (unsigned char)j;
+
+        /* now move the current character toward the front of the list */
+        UpdateMTFList(list, j, prev, method);
+        prev = j;
+    }
+}
+
+/***************************************************************************
+*   Function   : BWReverseXformFile
+*   Description: This function reverses a Burrows-Wheeler transformation
+*                on a file (with optional move to front) and writes the
+*                resulting data to the specified output file.  Comments in
+*                this function indicate corresponding variables, labels,
+*                and sections in "A Block-sorting Lossless Data Compression
+*                Algorithm" by M. Burrows and D.J. Wheeler.
+*   Parameters : fpIn - FILE pointer to file to reverse transform
+*                fpOut - FILE pointer to file to write reverse transformed
+*                          output to
+*                method - Set to XFORM_WITH_MTF, XFORM_WITH_MTF1, or
+*                      XFORM_WITH_MTF2 if move to front coding was applied.
+*                      OR with XFORM_WITH_RLE if run length encoding was
+*                      applied, and XFORM_WITH_CRC if blocks have CRCs.
+*   Effects    : A Burrows-Wheeler reverse transformation (and possibly
+*                move to front encoding) is applied to fpIn.   The results
+*                of the reverse transformation are written to fpOut.
+*   Returned   : Zero for success, otherwise non-zero.  Corrupt blocks are
+*                reported and no more data is written.
+***************************************************************************/
+int BWReverseXform(FILE *fpIn, FILE *fpOut, const xform_t method)
+{
+    rle_state_t rleState;       /* run length decoding of output */
+    unsigned int b;
+    unsigned int numBlocks;     /* number of blocks read together */
+    unsigned int decoded;       /* number of blocks that decoded */
+    reverse_work_t *work;       /* work areas for the reverse transform */
+    unsigned char *unrotated;   /* original blocks */
+    block_header_t header[DECODE_INTERLEAVE];   /* I, size, and CRC */
+    crc_table_t crcTable;       /* used if method has XFORM_WITH_CRC */
+    int result;
+#ifdef BWT_PROFILE
+    unsigned long totalBytes = 0;
+#endif
+
+    if ((NULL == fpIn) || (NULL == fpOut))
+    {
+        fprintf(stderr, "Invalid File Pointer Arguments\n");
+        return -1;
+    }
 
     /***********************************************************************
     * BLOCK_SIZE arrays are allocated on the heap, because gcc generates
     * code that throws a Segmentation fault when the large arrays are
     * allocated on the stack.
     ***********************************************************************/
-    encoded = (unsigned char *)malloc(length * sizeof(unsigned char));
+    work = (reverse_work_t *)Allocate(sizeof(reverse_work_t));
 
-    if (NULL == encoded)
+    if (NULL == work)
     {
-        perror("Allocating array to store MTF encoding");
+        perror("Allocating reverse transform work areas");
         return errno;
     }
 
-    /* copy last into encoded */
-    memcpy((void *)encoded, (void *)last, sizeof(unsigned char) * length);
+    unrotated = work->unrotated;
+    rleState.last = EOF;
+    rleState.runLength = 0;
 
-    /* start with alphabetically sorted list of characters */
-    for(i = 0; i <= UCHAR_MAX; i++)
+    if (method & XFORM_WITH_CRC)
     {
-        list[i] = (unsigned char)i;
+        BuildCRCTable(&crcTable);
     }
 
-    /* move-to-front decoding - W2 */
-    for (i = 0; i < length; i++)
+    for (;;)
     {
-        /* decode the character */
-        last[i] = list[encoded[i]];
+        /* read up to DECODE_INTERLEAVE blocks, only the final one is short */
+        for (numBlocks = 0; numBlocks < DECODE_INTERLEAVE; numBlocks++)
+        {
+            /* the CRC of the last block read is read into last too */
+            result = ReadBlock(fpIn, method,
+                &work->last[numBlocks * BLOCK_SIZE], &header[numBlocks]);
 
-        /* now move the current character to the front of the list */
-        memmove(&(list[1]), list, encoded[i]);
-        list[0] = last[i];
-    }
+            if (result <= 0)
+            {
+                break;
+            }
 
-    free(encoded);
-    return 0;
-}
+            if (header[numBlocks].length < BLOCK_SIZE)
+            {
+                numBlocks++;
+                break;
+            }
+        }
+
+        /* blocks read before a corrupt one are still written */
+        if (0 == numBlocks)
+        {
+            break;
+        }
+
+        decoded = DecodeBlocks(work->last, work->lf, unrotated, header,
+            numBlocks, method, &crcTable);
+
+        for (b = 0; b < decoded; b++)
+        {
+#ifdef BWT_PROFILE
+            totalBytes += header[b].length;
+#endif
+
+            if (method & XFORM_WITH_RLE)
+            {
+                WriteRLEBlock(&unrotated[b * BLOCK_SIZE], header[b].length,
+                    fpOut, &rleState);
+            }
+            else
+            {
+                fwrite(&unrotated[b * BLOCK_SIZE], sizeof(unsigned char),
+                    header[b].length, fpOut);
+            }
+        }
+
+        if ((decoded < numBlocks) || (result < 0))
+        {
+            /* don't write data known to be bad, or skip over it */
+            result = -1;
+            break;
+        }
+    }
+
+#ifdef BWT_PROFILE
+    ReportProfile("BWReverseXform", totalBytes);
+#endif
+
+    /* clean up */
+    Release(work, sizeof(reverse_work_t));
+    return result;
+}
+
+/***************************************************************************
+*   Function   : BWDecoderOpen
+*   Description: This function prepares to reverse a Burrows-Wheeler
+*                transformation on a file a block at a time, as the data is
+*                read with BWDecoderRead.
+*   Parameters : fpIn - FILE pointer to file to reverse transform
+*                method - Set to XFORM_WITH_MTF, XFORM_WITH_MTF1, or
+*                      XFORM_WITH_MTF2 if move to front coding was applied.
+*                      OR with XFORM_WITH_RLE if run length encoding was
+*                      applied, and XFORM_WITH_CRC if blocks have CRCs.
+*   Effects    : Memory for one block is allocated.
+*   Returned   : Pointer to the decoder, or NULL on failure.
+***************************************************************************/
+bwt_decoder_t *BWDecoderOpen(FILE *fpIn, const xform_t method)
+{
+    bwt_decoder_t *decoder;
+
+    if (NULL == fpIn)
+    {
+        fprintf(stderr, "Invalid File Pointer Arguments\n");
+        return NULL;
+    }
+
+    /* the decoder holds its block, so it is a single allocation */
+    decoder = (bwt_decoder_t *)Allocate(sizeof(bwt_decoder_t));
+
+    if (NULL == decoder)
+    {
+        perror("Allocating decoder");
+        return NULL;
+    }
+
+    decoder->fpIn = fpIn;
+    decoder->method = method;
+    decoder->length = 0;
+    decoder->next = 0;
+    decoder->rleState.last = EOF;
+    decoder->rleState.runLength = 0;
+    decoder->repeats = 0;
+    decoder->ended = 0;
+    decoder->failed = 0;
+
+    if (method & XFORM_WITH_CRC)
+    {
+        BuildCRCTable(&decoder->crcTable);
+    }
+
+    return decoder;
+}
+
+/***************************************************************************
+*   Function   : BWDecoderRead
+*   Description: This function reads reverse transformed data from a
+*                decoder opened by BWDecoderOpen.  Blocks are only decoded
+*                when their data is needed to fill buffer.
+*   Parameters : decoder - decoder returned by BWDecoderOpen
+*                buffer - buffer receiving the reverse transformed data
+*                size - the number of bytes to read into buffer
+*   Effects    : Up to size bytes are written to buffer, and blocks are
+*                read from the decoder's file as needed.
+*   Returned   : The number of bytes written to buffer, which is only less
+*                than size at the end of the stream or before a bad block,
+*                or -1 on error.  Once a block fails to decode, every
+*                following call returns -1.
+***************************************************************************/
+long BWDecoderRead(bwt_decoder_t *const decoder, void *const buffer,
+    const size_t size)
+{
+    unsigned char *out;
+    size_t count;                   /* bytes written to buffer */
+    size_t available;               /* bytes that can be copied at once */
+    int result;
+
+    if ((NULL == decoder) || (NULL == buffer))
+    {
+        fprintf(stderr, "Invalid Decoder Arguments\n");
+        return -1;
+    }
+
+    if (decoder->failed)
+    {
+        /* don't skip over a bad block to the ones after it */
+        return -1;
+    }
+
+    out = (unsigned char *)buffer;
+    count = 0;
+
+    while (count < size)
+    {
+        if (decoder->repeats > 0)
+        {
+            /* return what RLERepeats decoded, which may span calls */
+            out[count] = (unsigned char)decoder->rleState.last;
+            count++;
+            decoder->repeats--;
+            continue;
+        }
+
+        if (decoder->next == decoder->length)
+        {
+            result = DecodeNextBlock(decoder);
+
+            if (result < 0)
+            {
+                /* return what was decoded, the next call reports this */
+                decoder->failed = 1;
+                return (count > 0) ? (long)count : -1;
+            }
+            else if (0 == result)
+            {
+                /* end of stream */
+                break;
+            }
+        }
+
+        if (!(decoder->method & XFORM_WITH_RLE))
+        {
+            /* copy as much of the block as fits */
+            available = decoder->length - decoder->next;
+
+            if (available > size - count)
+            {
+                available = size - count;
+            }
+
+            memcpy(&out[count], &decoder->unrotated[decoder->next],
+                available);
+            count += available;
+            decoder->next += available;
+            continue;
+        }
+
+        /* its characters are returned at the top of the loop */
+        decoder->repeats = RLERepeats(decoder->unrotated[decoder->next],
+            &decoder->rleState);
+        decoder->next++;
+    }
+
+    return (long)count;
+}
+
+/***************************************************************************
+*   Function   : BWDecoderClose
+*   Description: This function releases a decoder opened by BWDecoderOpen.
+*                The decoder may be closed before all of its data has been
+*                read.
+*   Parameters : decoder - decoder returned by BWDecoderOpen
+*   Effects    : The decoder's memory is released.  Its file isn't closed.
+*   Returned   : NONE
+***************************************************************************/
+void BWDecoderClose(bwt_decoder_t *const decoder)
+{
+    if (NULL != decoder)
+    {
+        Release(decoder, sizeof(bwt_decoder_t));
+    }
+}
+
+/***************************************************************************
+*   Function   : DecodeNextBlock
+*   Description: This function reads the next block of a decoder's file
+*                and reverses its transformation.
+*   Parameters : decoder - decoder returned by BWDecoderOpen
+*   Effects    : The decoded block replaces the decoder's previous block.
+*   Returned   : 1 if a block was decoded, 0 at the end of the stream, or
+*                -1 on error.
+***************************************************************************/
+static int DecodeNextBlock(bwt_decoder_t *const decoder)
+{
+    block_header_t header;      /* I, size, and CRC of the block */
+    int result;
+
+    decoder->length = 0;
+    decoder->next = 0;
+
+    if (decoder->ended)
+    {
+        return 0;
+    }
+
+    result = ReadBlock(decoder->fpIn, decoder->method, decoder->last,
+        &header);
+
+    if (result <= 0)
+    {
+        return result;
+    }
+
+    /* only the final block is short */
+    if (header.length < BLOCK_SIZE)
+    {
+        decoder->ended = 1;
+    }
+
+    if (DecodeBlocks(decoder->last, decoder->lf, decoder->unrotated,
+        &header, 1, decoder->method, &decoder->crcTable) != 1)
+    {
+        return -1;
+    }
+
+    decoder->length = header.length;
+    return 1;
+}
+
+/***************************************************************************
+*   Function   : ReadBlock
+*   Description: This function reads the next block of a transformed
+*                stream: the index of S0 (I), the last characters of the
+*                sorted rotations (L), and the CRC that follows L if
+*                method has XFORM_WITH_CRC.
+*   Parameters : fpIn - FILE pointer to the transformed stream
+*                method - the method the stream was transformed with
+*                last - BLOCK_SIZE + CRC_SIZE characters receiving L and
+*                       the CRC that follows it
+*                header - receives I, the length of L, and the CRC
+*   Effects    : The block is read from fpIn into last and header.
+*   Returned   : 1 if a block was read, 0 at the end of the stream, or -1
+*                if the block is corrupt or can't be read.
+***************************************************************************/
+static int ReadBlock(FILE *fpIn, const xform_t method,
+    unsigned char *const last, block_header_t *const header)
+{
+    size_t length;              /* characters read after I */
+    size_t crcSize;             /* bytes of CRC following the block */
+
+    if (fread(&header->s0Idx, sizeof(int), 1, fpIn) != 1)
+    {
+        if (ferror(fpIn))
+        {
+            perror("Reading transformed block");
+            return -1;
+        }
+
+        return 0;
+    }
+
+    /* the final block is short, so its CRC is whatever follows its data */
+    crcSize = (method & XFORM_WITH_CRC) ? CRC_SIZE : 0;
+    length = fread(last, sizeof(unsigned char), BLOCK_SIZE + crcSize, fpIn);
+
+    if ((length <= crcSize) || (header->s0Idx < 0) ||
+        ((size_t)header->s0Idx >= length - crcSize))
+    {
+        fprintf(stderr, "Transformed stream is corrupt\n");
+        return -1;
+    }
+
+    header->length = length - crcSize;
+
+    /* the next block read may overwrite the CRC in last, so keep a copy */
+    header->crc = (crcSize != 0) ? GetCRC(&last[header->length]) : 0;
+    return 1;
+}
+
+/***************************************************************************
+*   Function   : DecodeBlocks
+*   Description: This function reverses the transformation of up to
+*                DECODE_INTERLEAVE blocks read by ReadBlock, and checks
+*                their CRCs.  Comments in this function indicate
+*                corresponding variables, labels, and sections in "A
+*                Block-sorting Lossless Data Compression Algorithm" by M.
+*                Burrows and D.J. Wheeler.
+*   Parameters : last - the last characters (L) of each block, BLOCK_SIZE
+*                       characters apart
+*                lf - room for the LF mapping of each block, BLOCK_SIZE
+*                     entries apart
+*                unrotated - receives each original block, BLOCK_SIZE
+*                            characters apart
+*                header - the header of each block
+*                numBlocks - the number of blocks to decode
+*                method - the method the blocks were transformed with
+*                crcTable - CRC table used if method has XFORM_WITH_CRC
+*   Effects    : The blocks are reverse transformed into unrotated.  Move
+*                to front coding of L is reversed in place.
+*   Returned   : The number of blocks before the first one that fails its
+*                CRC check (numBlocks if none do).
+***************************************************************************/
+static unsigned int DecodeBlocks(unsigned char *const last,
+    index_t *const lf, unsigned char *const unrotated,
+    const block_header_t *const header, const unsigned int numBlocks,
+    const xform_t method, const crc_table_t *const crcTable)
+{
+    const xform_t mtf = (xform_t)(method & XFORM_MTF_MASK);
+    unsigned int row[DECODE_INTERLEAVE];    /* current row in each LF walk */
+    size_t steps;               /* LF walk steps shared by all blocks */
+    size_t length;
+    unsigned int i, j, b;
+
+    steps = BLOCK_SIZE;
+
+    for (b = 0; b < numBlocks; b++)
+    {
+        if (XFORM_WITHOUT_MTF != mtf)
+        {
+            ProfileStart();
+            UndoMTF(&last[b * BLOCK_SIZE], header[b].length, mtf);
+            ProfileStop(STAGE_UNDO_MTF);
+        }
+
+        ProfileStart();
+        BuildLF(&last[b * BLOCK_SIZE], header[b].length, &lf[b * BLOCK_SIZE]);
+        ProfileStop(STAGE_LF_WALK);
+
+        row[b] = header[b].s0Idx;
+
+        if (header[b].length < steps)
+        {
+            steps = header[b].length;
+        }
+    }
+
+    ProfileStart();
+
+    /***********************************************************************
+    * Construct the initial unrotated strings (S[0]) of every block,
+    * walking their LF chains in lockstep.  Each step of a walk depends on
+    * the previous one, but steps of different blocks don't, so their
+    * cache misses overlap instead of stalling one after another.
+    ***********************************************************************/
+    for (j = 0; j < steps; j++)
+    {
+        for (b = 0; b < numBlocks; b++)
+        {
+            i = b * BLOCK_SIZE;
+            unrotated[i + header[b].length - j - 1] = last[i + row[b]];
+            row[b] = lf[i + row[b]];
+        }
+    }
+
+    /* finish any blocks that are longer than the shortest one */
+    for (b = 0; b < numBlocks; b++)
+    {
+        i = b * BLOCK_SIZE;
+        length = header[b].length;
+
+        for (j = steps; j < length; j++)
+        {
+            unrotated[i + length - j - 1] = last[i + row[b]];
+            row[b] = lf[i + row[b]];
+        }
+    }
+
+    ProfileStop(STAGE_LF_WALK);
+
+    if (method & XFORM_WITH_CRC)
+    {
+        for (b = 0; b < numBlocks; b++)
+        {
+            if (header[b].crc != CRC32C(crcTable, &unrotated[b * BLOCK_SIZE],
+                header[b].length))
+            {
+                fprintf(stderr, "Transformed block failed CRC check\n");
+                return b;
+            }
+        }
+    }
+
+    return numBlocks;
+}
+
+/***************************************************************************
+*   Function   : BuildLF
+*   Description: This function builds the mapping from each row of the
+*                sorted rotations to the row of the rotation that precedes
+*                it in the original string, using the array of last
+*                characters of the sorted rotations.  Comments in this
+*                function indicate corresponding variables, labels, and
+*                sections in "A Block-sorting Lossless Data Compression
+*                Algorithm" by M. Burrows and D.J. Wheeler.
+*   Parameters : last - the last characters of the sorted rotations (L)
+*                length - the number of unsigned chars contained in last.
+*                lf - array of length entries receiving the mapping
+*   Effects    : lf[i] is set to the row of the rotation ending with the
+*                character preceding last[i] (pred[i] + count[last[i]]).
+*   Returned   : NONE
+***************************************************************************/
+static void BuildLF(const unsigned char *const last, const size_t length,
+    index_t *const lf)
+{
+    unsigned int count[ALPHABET_SIZE];  /* count[i] = # of chars in L < i */
+    unsigned int i, j, sum;
+
+    /* code based on pseudo code from section 4.2 (D1 and D2) follows */
+    for(i = 0; i < ALPHABET_SIZE; i++)
+    {
+        count[i] = 0;
+    }
+
+    /***********************************************************************
+    * Set lf[i] to the number of times last[i] appears in the substring
+    * last[0 .. i - 1] (pred[i]).  As a useful side effect count[i] will
+    * be the number of times character i appears in last.
+    ***********************************************************************/
+    for (i = 0; i < length; i++)
+    {
+        lf[i] = count[last[i]];
+        count[last[i]]++;
+    }
+
+    /***********************************************************************
+    * Set count[i] to the number of characters in last lexicographically
+    * less than i.
+    ***********************************************************************/
+    sum = 0;
+    for(i = 0; i < ALPHABET_SIZE; i++)
+    {
+        j = count[i];
+        count[i] = sum;
+        sum += j;
+    }
+
+    /* finally, add the count of smaller characters to each pred[i] */
+    for (i = 0; i < length; i++)
+    {
+        lf[i] += count[last[i]];
+    }
+}
+
+/***************************************************************************
+*   Function   : UndoMTF
+*   Description: This function reverses move to front encoding on a block
+*                on of data that has already had the Burrows-Wheeler
+*                transformation applied to it.  Comments in this function
+*                indicate corresponding variables, labels, and sections in
+*                "A Block-sorting Lossless Data Compression Algorithm" by
+*                M. Burrows and D.J. Wheeler.
+*   Parameters : last - pointer an array of mtf encoded characters from
+*                       Burrows-Wheeler rotations.
+*                length - the number of unsigned chars contained in last.
+*                method - the move to front variant that was applied
+*   Effects    : Move to front encoding is reversed on an array of last
+*                characters.  The results of the reversal are stored in
+*                the array last (L), providing an array of last characters
+*                of sorted rotations.
+*   Returned   : NONE
+***************************************************************************/
+static void UndoMTF(unsigned char *const last, const int length,
+    const xform_t method)
+{
+    unsigned char list[ALPHABET_SIZE];      /* list of characters (Y) */
+    int i;
+    int position;                           /* encoded position (R) */
+    int prev;                               /* previously decoded position */
+
+    /* start with alphabetically sorted list of characters */
+    for(i = 0; i < ALPHABET_SIZE; i++)
+    {
+        list[i] = (unsigned char)i;
+    }
+
+    prev = 0;
+
+    /* move-to-front decoding - W2 */
+    for (i = 0; i < length; i++)
+    {
+        /* decode the character in place */
+        position = last[i];
+        last[i] = list[position];
+
+        /* now move the current character toward the front of the list */
+        UpdateMTFList(list, position, prev, method);
+        prev = position;
+    }
+}
+
+/***************************************************************************
+*   Function   : UpdateMTFList
+*   Description: This function moves the character just (de)coded toward
+*                the front of the move to front list, following the rules
+*                of the selected move to front variant.  Classic MTF always
+*                moves the character to the front.  MTF-1 moves characters
+*                from position 1 to the front and characters from later
+*                positions to position 1.  MTF-2 is MTF-1, except that a
+*                character at position 1 only moves to the front if the
+*                previous character wasn't at the front.
+*   Parameters : list - the move to front list of characters (Y)
+*                position - position of the character just (de)coded
+*                prevPosition - position of the previous character
+*                method - the move to front variant being applied
+*   Effects    : The character at list[position] is moved toward the front
+*                of list.
+*   Returned   : NONE
+***************************************************************************/
+static void UpdateMTFList(unsigned char *const list, const int position,
+    const int prevPosition, const xform_t method)
+{
+    unsigned char c;
+    int to;                                 /* new position of character */
+
+    if (0 == position)
+    {
+        /* already at the front */
+        return;
+    }
+
+    if (XFORM_WITH_MTF == method)
+    {
+        to = 0;
+    }
+    else if (position > 1)
+    {
+        to = 1;
+    }
+    else if ((XFORM_WITH_MTF2 == method) && (0 == prevPosition))
+    {
+        /* MTF-2 leaves position 1 alone following a front character */
+        return;
+    }
+    else
+    {
+        to = 0;
+    }
+
+    c = list[position];
+    memmove(&(list[to + 1]), &(list[to]), position - to);
+    list[to] = c;
+}
+
+/***************************************************************************
+*   Function   : BuildCRCTable
+*   Description: This function builds the tables used by CRC32C.
+*                entry[0] holds the CRC-32C of each single byte, and
+*                entry[k] holds the CRC of each byte followed by k zero
+*                bytes, so four bytes can be folded in with one lookup
+*                each.
+*   Parameters : table - the tables to build
+*   Effects    : table is filled in.
+*   Returned   : NONE
+***************************************************************************/
+static void BuildCRCTable(crc_table_t *const table)
+{
+    unsigned long crc;
+    unsigned int i, k;
+
+    for (i = 0; i < ALPHABET_SIZE; i++)
+    {
+        crc = i;
+
+        for (k = 0; k < 8; k++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ CRC_POLYNOMIAL : crc >> 1;
+        }
+
+        table->entry[0][i] = crc;
+    }
+
+    for (i = 0; i < ALPHABET_SIZE; i++)
+    {
+        crc = table->entry[0][i];
+
+        for (k = 1; k < 4; k++)
+        {
+            crc = (crc >> 8) ^ table->entry[0][crc & 0xFF];
+            table->entry[k][i] = crc;
+        }
+    }
+}
+
+/***************************************************************************
+*   Function   : CRC32C
+*   Description: This function computes the CRC-32C (Castagnoli) of an
+*                array, four bytes at a time.
+*   Parameters : table - tables built by BuildCRCTable
+*                data - array of characters to checksum
+*                length - the number of unsigned chars contained in data.
+*   Effects    : NONE
+*   Returned   : The CRC-32C of data.
+***************************************************************************/
+static unsigned long CRC32C(const crc_table_t *const table,
+    const unsigned char *const data, const size_t length)
+{
+    unsigned long crc;
+    size_t i;
+
+    crc = 0xFFFFFFFFUL;
+
+    for (i = 0; i + 3 < length; i += 4)
+    {
+        /* bytes are combined one at a time, so byte order doesn't matter */
+        crc ^= (unsigned long)data[i] |
+            ((unsigned long)data[i + 1] << 8) |
+            ((unsigned long)data[i + 2] << 16) |
+            ((unsigned long)data[i + 3] << 24);
+
+        crc = table->entry[3][crc & 0xFF] ^
+            table->entry[2][(crc >> 8) & 0xFF] ^
+            table->entry[1][(crc >> 16) & 0xFF] ^
+            table->entry[0][(crc >> 24) & 0xFF];
+    }
+
+    /* checksum what's left over */
+    for (; i < length; i++)
+    {
+        crc = (crc >> 8) ^ table->entry[0][(crc ^ data[i]) & 0xFF];
+    }
+
+    return crc ^ 0xFFFFFFFFUL;
+}
+
+/***************************************************************************
+*   Function   : WriteCRC
+*   Description: This function writes a block's CRC as CRC_SIZE bytes,
+*                least significant first, so streams are portable.
+*   Parameters : crc - the CRC to write
+*                fpOut - FILE pointer to file receiving the CRC
+*   Effects    : The CRC is written to fpOut.
+*   Returned   : NONE
+***************************************************************************/
+static void WriteCRC(const unsigned long crc, FILE *fpOut)
+{
+    unsigned int i;
+
+    for (i = 0; i < CRC_SIZE; i++)
+    {
+        putc((int)((crc >> (8 * i)) & 0xFF), fpOut);
+    }
+}
+
+/***************************************************************************
+*   Function   : GetCRC
+*   Description: This function returns the CRC written by WriteCRC.
+*   Parameters : data - the CRC_SIZE bytes following a block
+*   Effects    : NONE
+*   Returned   : The CRC.
+***************************************************************************/
+static unsigned long GetCRC(const unsigned char *const data)
+{
+    unsigned long crc;
+    unsigned int i;
+
+    crc = 0;
+
+    for (i = 0; i < CRC_SIZE; i++)
+    {
+        crc |= (unsigned long)data[i] << (8 * i);
+    }
+
+    return crc;
+}
+
+#ifdef BWT_PROFILE
+/***************************************************************************
+*   Function   : ReportProfile
+*   Description: This function writes the time accumulated in each stage
+*                of a transform to stderr, normalized per byte of input,
+*                and then clears the accumulated times.
+*   Parameters : label - name of the transform being reported on
+*                bytes - the number of bytes (un)transformed
+*   Effects    : The accumulated stage times are written to stderr and
+*                reset to zero.
+*   Returned   : NONE
+***************************************************************************/
+static void ReportProfile(const char *const label, const unsigned long bytes)
+{
+    static const char *const stageNames[NUM_STAGES] =
+    {
+        "radix sort", "bucket sort", "MTF", "undo MTF", "LF walk"
+    };
+    int i;
+
+    fprintf(stderr, "%s: %lu bytes\n", label, bytes);
+
+    for (i = 0; i < NUM_STAGES; i++)
+    {
+        if (stageTime[i] != 0)
+        {
+            double seconds = (double)stageTime[i] / CLOCKS_PER_SEC;
+
+            fprintf(stderr, "  %-12s %9.3f s", stageNames[i], seconds);
+
+            if (bytes != 0)
+            {
+                fprintf(stderr, " %9.2f ns/byte", (seconds * 1.0e9) / bytes);
+            }
+
+            fprintf(stderr, "\n");
+        }
+
+        stageTime[i] = 0;
+    }
+}
+#endif
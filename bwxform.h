@@ -40,20 +40,76 @@
 typedef enum
 {
     XFORM_WITHOUT_MTF = 0,
-    XFORM_WITH_MTF = 1
+    XFORM_WITH_MTF = 1,     /* classic move to front */
+    XFORM_WITH_MTF1 = 2,    /* MTF-1: only symbols at position 1 go to front */
+    XFORM_WITH_MTF2 = 3,    /* MTF-2: MTF-1, but 1 goes to front after non-0 */
+    XFORM_MTF_MASK = 0x0F,  /* bits selecting one of the MTF values above */
+
+    /* flags that may be ORed with one of the MTF values above */
+    XFORM_WITH_RLE = 0x10,  /* run length encode runs of 4+ before BWT */
+    XFORM_WITH_CRC = 0x20   /* follow each block with a CRC-32C of its data */
 } xform_t;
 
+/***************************************************************************
+*                            TYPE DEFINITIONS
+***************************************************************************/
+/* functions used by the library to obtain and return its work areas */
+typedef struct
+{
+    /* returns size bytes of suitably aligned memory or NULL */
+    void *(*allocate)(size_t size, void *context);
+
+    /* returns memory obtained from allocate along with its size */
+    void (*release)(void *ptr, size_t size, void *context);
+
+    void *context;      /* passed unchanged to allocate and release */
+} bwt_allocator_t;
+
+/* state of a stream being reverse transformed a block at a time */
+typedef struct bwt_decoder_t bwt_decoder_t;
+
 /***************************************************************************
 *                               PROTOTYPES
 ***************************************************************************/
 
 /***************************************************************************
 * Transform/Reverse Transform file stream fpIn writing results to fpOut.
-* Use method to indicate whether or not to use MTF.
-* Zero is returned on success.
+* Use method to indicate whether or not to use MTF, and which variant, ORed
+* with XFORM_WITH_RLE to run length encode the data before transforming it
+* and XFORM_WITH_CRC to check each block for corruption when it is reverse
+* transformed.  Zero is returned on success.
 ***************************************************************************/
 /* Transform/Reverse Tran fpIn save results to fpOut.  Use MTF if mtf is TRUE */
 int BWXform(FILE *fpIn, FILE *fpOut, const xform_t method);
 int BWReverseXform(FILE *fpIn, FILE *fpOut, const xform_t method);
 
+/***************************************************************************
+* Append the transform of file stream fpIn to the transformed stream fpOut,
+* which must be open for reading and writing.  Use the method fpOut was
+* transformed with (XFORM_WITH_RLE isn't supported).
+* Zero is returned on success.
+***************************************************************************/
+int BWXformAppend(FILE *fpIn, FILE *fpOut, const xform_t method);
+
+/***************************************************************************
+* Reverse transform file stream fpIn as its data is read.  Each block is
+* only decoded when BWDecoderRead needs its data, and only one block is
+* held in memory.  BWDecoderRead returns the number of bytes placed in
+* buffer (less than size at the end of the stream or before a bad block) or
+* -1 on error, and -1 on every call after an error.  Closing the decoder
+* doesn't close fpIn.
+***************************************************************************/
+bwt_decoder_t *BWDecoderOpen(FILE *fpIn, const xform_t method);
+long BWDecoderRead(bwt_decoder_t *const decoder, void *const buffer,
+    const size_t size);
+void BWDecoderClose(bwt_decoder_t *const decoder);
+
+/***************************************************************************
+* Use allocator for all of the library's work areas, or malloc and free if
+* allocator is NULL (or either of its functions is NULL).  The allocator is
+* copied and shared by every call, so it must not be changed while a
+* transform is in progress.
+***************************************************************************/
+void BWSetAllocator(const bwt_allocator_t *const allocator);
+
 #endif  /* ndef _BWXFORM_H_ */
@@ -35,12 +35,53 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "optlist/optlist.h"
 #include "bwxform.h"
 
+/***************************************************************************
+*                                CONSTANTS
+***************************************************************************/
+#define IO_BUFFER_SIZE  (1024 * 1024)   /* stdio buffer size for each file */
+
+#define BATCH_EXTENSION ".bwt"  /* added to names of files encoded in batch */
+#define DECODE_EXTENSION ".out" /* added to decoded names without ".bwt" */
+
+#define PULL_CHUNK_SIZE 1000    /* bytes read from the decoder at once (-p) */
+
+#define MAX_TRACKED     8       /* work areas that may be live at once (-t) */
+
+/***************************************************************************
+*                            TYPE DEFINITIONS
+***************************************************************************/
+/* library work areas checked by the -t option */
+typedef struct
+{
+    void *ptr[MAX_TRACKED];     /* work areas that haven't been released */
+    size_t size[MAX_TRACKED];   /* size each work area was allocated with */
+    int numLive;                /* number of entries in ptr and size */
+    int errors;                 /* number of mismatched releases */
+} alloc_tracker_t;
+
+/***************************************************************************
+*                            GLOBAL VARIABLES
+***************************************************************************/
+static char inBuffer[IO_BUFFER_SIZE];       /* input file stdio buffer */
+static char outBuffer[IO_BUFFER_SIZE];      /* output file stdio buffer */
+static alloc_tracker_t tracker;             /* context of -t allocator */
+
 /***************************************************************************
 *                               PROTOTYPES
 ***************************************************************************/
+static int ProcessFile(const char *const inName, const char *const outName,
+    const char encode, const char append, const char pull,
+    const xform_t method, unsigned long *const inBytes,
+    unsigned long *const outBytes);
+static int PullDecode(FILE *fpIn, FILE *fpOut, const xform_t method);
+static void *TrackedAllocate(size_t size, void *context);
+static void TrackedRelease(void *ptr, size_t size, void *context);
+static int CheckAllocations(alloc_tracker_t *const tracked);
+static char *BatchOutputName(const char *const inName, const char encode);
 
 /***************************************************************************
 *                                FUNCTIONS
@@ -52,27 +93,62 @@
 *                the command line input and, if valid, it will call
 *                functions to transform or reverse transform a file using
 *                the Burrows-Wheeler trasnform algorithm with or without
-*                additional move to front coding.
+*                additional move to front coding.  If more than one input
+*                file is specified, each one is processed in turn and a
+*                summary of the batch is printed.
 *   Parameters : argc - number of parameters
 *                argv - parameter list
-*   Effects    : Encodes/Decodes input file
+*   Effects    : Encodes/Decodes input files
 *   Returned   : EXIT_SUCCESS for success, otherwise EXIT_FAILURE.
 ***************************************************************************/
 int main(int argc, char *argv[])
 {
     option_t *optList, *thisOpt;
-    FILE *inFile, *outFile; /* pointer to input & output files */
+    char **inNames;         /* names of input files */
+    int numInputs;          /* number of input files */
+    char *outName;          /* name of output file */
     char encode;            /* encode/decode */
+    char append;            /* append to existing output */
+    char pull;              /* decode through a pull decoder */
+    char track;             /* check the library's work areas */
+    bwt_allocator_t trackingAllocator;      /* allocator used with -t */
     xform_t method;         /* perform move to front */
+    int rle;                /* perform run length encoding */
+    int crc;                /* add/verify block CRCs */
+    int result;             /* value returned by library */
+    int failures;           /* number of batch files that failed */
+    int i, j;
+    unsigned long inBytes, outBytes;        /* sizes of one file */
+    unsigned long totalIn, totalOut;        /* sizes of all batch files */
+    time_t start;                           /* start of batch */
+    clock_t fileStart;                      /* start of one file */
+    clock_t fileTime;                       /* CPU time of one file */
+    clock_t transformTime;                  /* CPU time of all batch files */
+    double seconds;                         /* CPU seconds of transforms */
+    FILE *existing;                         /* batch output already there */
+
+    /* there can't be more input files than arguments */
+    inNames = (char **)malloc(argc * sizeof(char *));
+
+    if (NULL == inNames)
+    {
+        perror("Allocating list of input files");
+        exit(EXIT_FAILURE);
+    }
 
     /* initialize data */
-    inFile = NULL;
-    outFile = NULL;
+    numInputs = 0;
+    outName = NULL;
     encode = 1;
+    append = 0;
+    pull = 0;
+    track = 0;
     method = XFORM_WITHOUT_MTF;
+    rle = 0;
+    crc = 0;
 
     /* parse command line */
-    optList = GetOptList(argc, argv, "cdmi:o:h?");
+    optList = GetOptList(argc, argv, "cdapm12rkti:o:h?");
     thisOpt = optList;
 
     while (thisOpt != NULL)
@@ -87,66 +163,55 @@ int main(int argc, char *argv[])
                 encode = 0;
                 break;
 
+            case 'a':       /* append to output */
+                append = 1;
+                break;
+
+            case 'p':       /* decode with BWDecoderRead */
+                pull = 1;
+                break;
+
             case 'm':       /* perform move to front */
                 method = XFORM_WITH_MTF;
                 break;
 
-            case 'i':       /* input file name */
-                if (inFile != NULL)
-                {
-                    fprintf(stderr, "Multiple input files not allowed.\n");
-                    fclose(inFile);
+            case '1':       /* perform MTF-1 */
+                method = XFORM_WITH_MTF1;
+                break;
 
-                    if (outFile != NULL)
-                    {
-                        fclose(outFile);
-                    }
+            case '2':       /* perform MTF-2 */
+                method = XFORM_WITH_MTF2;
+                break;
 
-                    FreeOptList(optList);
-                    exit(EXIT_FAILURE);
-                }
-                else if ((inFile = fopen(thisOpt->argument, "rb")) == NULL)
-                {
-                    perror("Opening Input File");
+            case 'r':       /* perform run length encoding */
+                rle = 1;
+                break;
 
-                    if (outFile != NULL)
-                    {
-                        fclose(outFile);
-                    }
+            case 'k':       /* add/verify block CRCs */
+                crc = 1;
+                break;
 
-                    FreeOptList(optList);
-                    exit(EXIT_FAILURE);
-                }
+            case 't':       /* track work area allocations */
+                track = 1;
+                break;
 
+            case 'i':       /* input file name */
+                /* files are opened one at a time as they are processed */
+                inNames[numInputs] = thisOpt->argument;
+                numInputs++;
                 break;
 
             case 'o':       /* output file name */
-                if (outFile != NULL)
+                if (outName != NULL)
                 {
                     fprintf(stderr, "Multiple output files not allowed.\n");
-                    fclose(outFile);
-
-                    if (inFile != NULL)
-                    {
-                        fclose(inFile);
-                    }
-
-                    FreeOptList(optList);
-                    exit(EXIT_FAILURE);
-                }
-                else if ((outFile = fopen(thisOpt->argument, "wb")) == NULL)
-                {
-                    perror("Opening Output File");
-
-                    if (inFile != NULL)
-                    {
-                        fclose(inFile);
-                    }
-
+                    free(inNames);
                     FreeOptList(optList);
                     exit(EXIT_FAILURE);
                 }
 
+                /* open after all options are known, so -a may follow */
+                outName = thisOpt->argument;
                 break;
 
             case 'h':
@@ -155,11 +220,24 @@ int main(int argc, char *argv[])
                 printf("options:\n");
                 printf("  -c : Encode input file to output file.\n");
                 printf("  -d : Decode input file to output file.\n");
+                printf("  -a : Encode input file appending to output file.\n");
+                printf("  -p : Decode with the pull decoder, a chunk at a");
+                printf(" time.\n");
                 printf("  -m : Perform the Move-to-Front coding.\n");
-                printf("  -i <filename> : Name of input file.\n");
-                printf("  -o <filename> : Name of output file.\n");
+                printf("  -1 : Perform the MTF-1 variant of Move-to-Front.\n");
+                printf("  -2 : Perform the MTF-2 variant of Move-to-Front.\n");
+                printf("  -r : Run length encode runs before transforming.\n");
+                printf("  -k : Add/verify a CRC of each block.\n");
+                printf("  -t : Check that library work areas are released.\n");
+                printf("  -i <filename> : Name of input file.  May be repeated");
+                printf(" for a batch.\n");
+                printf("  -o <filename> : Name of output file.  Batches write");
+                printf(" <input>%s\n", BATCH_EXTENSION);
+                printf("                  when encoding and <input> without");
+                printf(" %s when decoding.\n", BATCH_EXTENSION);
                 printf("  -h | ?  : Print out command line options.\n\n");
                 printf("Default: %s -c\n", FindFileName(argv[0]));
+                free(inNames);
                 FreeOptList(optList);
                 return(EXIT_SUCCESS);
         }
@@ -170,42 +248,440 @@ int main(int argc, char *argv[])
     }
 
     /* validate command line */
-    if (inFile == NULL)
+    if (0 == numInputs)
     {
         fprintf(stderr, "Input file must be provided\n");
         fprintf(stderr, "Enter \"%s -?\" for help.\n", FindFileName(argv[0]));
+        free(inNames);
+        exit (EXIT_FAILURE);
+    }
+    else if ((1 == numInputs) && (outName == NULL))
+    {
+        fprintf(stderr, "Output file must be provided\n");
+        fprintf(stderr, "Enter \"%s -?\" for help.\n", FindFileName(argv[0]));
+        free(inNames);
+        exit (EXIT_FAILURE);
+    }
+    else if ((numInputs > 1) && (outName != NULL))
+    {
+        fprintf(stderr, "Output file may not be used with multiple inputs\n");
+        fprintf(stderr, "Enter \"%s -?\" for help.\n", FindFileName(argv[0]));
+        free(inNames);
+        exit (EXIT_FAILURE);
+    }
+
+    if (append && !encode)
+    {
+        fprintf(stderr, "Append (-a) may only be used when encoding\n");
+        free(inNames);
+        exit (EXIT_FAILURE);
+    }
+
+    if (pull && encode)
+    {
+        fprintf(stderr, "Pull decoding (-p) may only be used when decoding\n");
+        free(inNames);
+        exit (EXIT_FAILURE);
+    }
+
+    if (rle)
+    {
+        method = (xform_t)(method | XFORM_WITH_RLE);
+    }
 
-        if (outFile != NULL)
+    if (crc)
+    {
+        method = (xform_t)(method | XFORM_WITH_CRC);
+    }
+
+    if (track)
+    {
+        /* the library's work areas come from TrackedAllocate */
+        tracker.numLive = 0;
+        tracker.errors = 0;
+        trackingAllocator.allocate = TrackedAllocate;
+        trackingAllocator.release = TrackedRelease;
+        trackingAllocator.context = &tracker;
+        BWSetAllocator(&trackingAllocator);
+    }
+
+    if (1 == numInputs)
+    {
+        result = ProcessFile(inNames[0], outName, encode, append, pull,
+            method, &inBytes, &outBytes);
+        free(inNames);
+
+        if (track && (CheckAllocations(&tracker) != 0))
         {
-            free(outFile);
+            result = -1;
         }
 
-        exit (EXIT_FAILURE);
+        return (0 == result) ? EXIT_SUCCESS : EXIT_FAILURE;
     }
-    else if (outFile == NULL)
+
+    /* process a batch of files, naming each output after its input */
+    failures = 0;
+    totalIn = 0;
+    transformTime = 0;
+    totalOut = 0;
+    start = time(NULL);
+
+    for (i = 0; i < numInputs; i++)
     {
-        fprintf(stderr, "Output file must be provided\n");
-        fprintf(stderr, "Enter \"%s -?\" for help.\n", FindFileName(argv[0]));
+        outName = BatchOutputName(inNames[i], encode);
 
-        if (inFile != NULL)
+        if (NULL == outName)
         {
-            free(inFile);
+            perror("Allocating output file name");
+            failures++;
+            continue;
         }
 
-        exit (EXIT_FAILURE);
+        /* like gzip, don't overwrite files or write later inputs */
+        for (j = i + 1; j < numInputs; j++)
+        {
+            if (0 == strcmp(outName, inNames[j]))
+            {
+                break;
+            }
+        }
+
+        if (j < numInputs)
+        {
+            fprintf(stderr, "%s is also an input\n", outName);
+            fprintf(stderr, "Failed to process %s\n", inNames[i]);
+            free(outName);
+            failures++;
+            continue;
+        }
+
+        if (!append && ((existing = fopen(outName, "rb")) != NULL))
+        {
+            fclose(existing);
+            fprintf(stderr, "%s already exists\n", outName);
+            fprintf(stderr, "Failed to process %s\n", inNames[i]);
+            free(outName);
+            failures++;
+            continue;
+        }
+
+        /* time each file, so short batches still report throughput */
+        fileStart = clock();
+        result = ProcessFile(inNames[i], outName, encode, append, pull,
+            method, &inBytes, &outBytes);
+        fileTime = clock() - fileStart;
+
+        if (0 == result)
+        {
+            printf("%s -> %s\n", inNames[i], outName);
+            totalIn += inBytes;
+            totalOut += outBytes;
+            transformTime += fileTime;
+        }
+        else
+        {
+            fprintf(stderr, "Failed to process %s\n", inNames[i]);
+            failures++;
+        }
+
+        free(outName);
+    }
+
+    printf("%d of %d files, %lu bytes in, %lu bytes out\n",
+        numInputs - failures, numInputs, totalIn, totalOut);
+
+    if (totalIn > 0)
+    {
+        /* files faster than the clock's resolution count as one tick */
+        if (0 == transformTime)
+        {
+            transformTime = 1;
+        }
+
+        seconds = (double)transformTime / CLOCKS_PER_SEC;
+        printf("%.3f CPU seconds transforming, %.2f MB/s\n", seconds,
+            (totalIn / seconds) / (1024 * 1024));
+    }
+
+    printf("%.0f seconds wall clock time\n", difftime(time(NULL), start));
+    free(inNames);
+
+    if (track && (CheckAllocations(&tracker) != 0))
+    {
+        return EXIT_FAILURE;
+    }
+
+    return (0 == failures) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/***************************************************************************
+*   Function   : ProcessFile
+*   Description: This function opens an input and output file and
+*                transforms or reverse transforms the input into the
+*                output.
+*   Parameters : inName - name of the input file
+*                outName - name of the output file
+*                encode - non-zero to transform, zero to reverse transform
+*                append - non-zero to append to the output when encoding
+*                pull - non-zero to reverse transform with PullDecode
+*                method - the xform_t method to use
+*                inBytes - receives the size of the input file
+*                outBytes - receives the size of the output file
+*   Effects    : Encodes/Decodes inName into outName
+*   Returned   : Zero for success, otherwise non-zero.
+***************************************************************************/
+static int ProcessFile(const char *const inName, const char *const outName,
+    const char encode, const char append, const char pull,
+    const xform_t method, unsigned long *const inBytes,
+    unsigned long *const outBytes)
+{
+    FILE *inFile, *outFile; /* pointer to input & output files */
+    int result;             /* value returned by library */
+
+    if ((inFile = fopen(inName, "rb")) == NULL)
+    {
+        perror("Opening Input File");
+        return -1;
     }
 
+    if (append)
+    {
+        /* append to the existing output, or start a new one */
+        if ((outFile = fopen(outName, "r+b")) == NULL)
+        {
+            outFile = fopen(outName, "w+b");
+        }
+    }
+    else
+    {
+        outFile = fopen(outName, "wb");
+    }
+
+    if (outFile == NULL)
+    {
+        perror("Opening Output File");
+        fclose(inFile);
+        return -1;
+    }
+
+    /* use large buffers so blocks aren't read and written piecemeal */
+    setvbuf(inFile, inBuffer, _IOFBF, IO_BUFFER_SIZE);
+    setvbuf(outFile, outBuffer, _IOFBF, IO_BUFFER_SIZE);
+
     /* we have valid parameters encode or decode */
-    if (encode)
+    if (append)
+    {
+        result = BWXformAppend(inFile, outFile, method);
+    }
+    else if (encode)
     {
-        BWXform(inFile, outFile, method);
+        result = BWXform(inFile, outFile, method);
+    }
+    else if (pull)
+    {
+        result = PullDecode(inFile, outFile, method);
     }
     else
     {
-        BWReverseXform(inFile, outFile, method);
+        result = BWReverseXform(inFile, outFile, method);
     }
 
+    /* both files have been read or written to their ends */
+    *inBytes = (unsigned long)ftell(inFile);
+    *outBytes = (unsigned long)ftell(outFile);
+
     fclose(inFile);
-    fclose(outFile);
-    return EXIT_SUCCESS;
+
+    if ((fclose(outFile) != 0) && (0 == result))
+    {
+        perror("Closing Output File");
+        result = -1;
+    }
+
+    return result;
+}
+
+/***************************************************************************
+*   Function   : PullDecode
+*   Description: This function reverse transforms a file by reading it
+*                from a decoder (see BWDecoderOpen) PULL_CHUNK_SIZE bytes
+*                at a time, the way a consumer of the decoded data would.
+*   Parameters : fpIn - FILE pointer to file to reverse transform
+*                fpOut - FILE pointer to file receiving the decoded data
+*                method - the xform_t method fpIn was transformed with
+*   Effects    : The reverse transformation of fpIn is written to fpOut,
+*                up to the first block that can't be decoded.
+*   Returned   : Zero for success, otherwise non-zero.
+***************************************************************************/
+static int PullDecode(FILE *fpIn, FILE *fpOut, const xform_t method)
+{
+    bwt_decoder_t *decoder;
+    unsigned char chunk[PULL_CHUNK_SIZE];
+    long count;             /* bytes read from the decoder */
+
+    decoder = BWDecoderOpen(fpIn, method);
+
+    if (NULL == decoder)
+    {
+        return -1;
+    }
+
+    /* a short read may precede a bad block, so read until 0 or -1 */
+    while ((count = BWDecoderRead(decoder, chunk, PULL_CHUNK_SIZE)) > 0)
+    {
+        fwrite(chunk, sizeof(unsigned char), (size_t)count, fpOut);
+    }
+
+    BWDecoderClose(decoder);
+    return (count < 0) ? -1 : 0;
+}
+
+/***************************************************************************
+*   Function   : TrackedAllocate
+*   Description: This function is the allocate function of the allocator
+*                installed by -t.  It allocates library work areas with
+*                malloc and records their sizes.
+*   Parameters : size - the number of bytes to allocate
+*                context - the alloc_tracker_t recording work areas
+*   Effects    : Memory is allocated and recorded in context.
+*   Returned   : Pointer to the allocated memory or NULL on failure.
+***************************************************************************/
+static void *TrackedAllocate(size_t size, void *context)
+{
+    alloc_tracker_t *const tracked = (alloc_tracker_t *)context;
+    void *ptr;
+
+    if (MAX_TRACKED == tracked->numLive)
+    {
+        fprintf(stderr, "More than %d work areas allocated\n", MAX_TRACKED);
+        tracked->errors++;
+        return NULL;
+    }
+
+    ptr = malloc(size);
+
+    if (NULL != ptr)
+    {
+        tracked->ptr[tracked->numLive] = ptr;
+        tracked->size[tracked->numLive] = size;
+        tracked->numLive++;
+    }
+
+    return ptr;
+}
+
+/***************************************************************************
+*   Function   : TrackedRelease
+*   Description: This function is the release function of the allocator
+*                installed by -t.  It checks that each work area released
+*                was allocated by TrackedAllocate with the same size.
+*   Parameters : ptr - the memory to release
+*                size - the number of bytes the library says it allocated
+*                context - the alloc_tracker_t recording work areas
+*   Effects    : Memory is released and removed from context.  Mismatched
+*                releases are reported and counted in context.
+*   Returned   : NONE
+***************************************************************************/
+static void TrackedRelease(void *ptr, size_t size, void *context)
+{
+    alloc_tracker_t *const tracked = (alloc_tracker_t *)context;
+    int i;
+
+    for (i = 0; i < tracked->numLive; i++)
+    {
+        if (tracked->ptr[i] == ptr)
+        {
+            break;
+        }
+    }
+
+    if (i == tracked->numLive)
+    {
+        /* don't free memory that may not be from malloc */
+        fprintf(stderr, "Released a work area that wasn't allocated\n");
+        tracked->errors++;
+        return;
+    }
+
+    if (tracked->size[i] != size)
+    {
+        fprintf(stderr, "Work area of %lu bytes released as %lu bytes\n",
+            (unsigned long)tracked->size[i], (unsigned long)size);
+        tracked->errors++;
+    }
+
+    free(ptr);
+
+    /* move the last live work area into the released one's place */
+    tracked->numLive--;
+    tracked->ptr[i] = tracked->ptr[tracked->numLive];
+    tracked->size[i] = tracked->size[tracked->numLive];
+}
+
+/***************************************************************************
+*   Function   : CheckAllocations
+*   Description: This function checks that every work area allocated with
+*                TrackedAllocate was released by TrackedRelease with the
+*                size it was allocated with.
+*   Parameters : tracked - the alloc_tracker_t recording work areas
+*   Effects    : Problems are reported to stderr.
+*   Returned   : Zero if the work areas were released correctly, otherwise
+*                non-zero.
+***************************************************************************/
+static int CheckAllocations(alloc_tracker_t *const tracked)
+{
+    if (tracked->numLive != 0)
+    {
+        fprintf(stderr, "%d work areas weren't released\n", tracked->numLive);
+        tracked->errors++;
+    }
+
+    return tracked->errors;
+}
+
+/***************************************************************************
+*   Function   : BatchOutputName
+*   Description: This function creates the name of the output file for an
+*                input file in a batch.  Encoded files are named after the
+*                input with BATCH_EXTENSION added.  Decoded files are named
+*                after the input with BATCH_EXTENSION removed, or with
+*                DECODE_EXTENSION added if it doesn't end with
+*                BATCH_EXTENSION.
+*   Parameters : inName - name of the input file
+*                encode - non-zero if the input is being transformed
+*   Effects    : Memory for the name is allocated.
+*   Returned   : The output file name, which must be freed, or NULL if
+*                it can't be allocated.
+***************************************************************************/
+static char *BatchOutputName(const char *const inName, const char encode)
+{
+    const size_t extLength = strlen(BATCH_EXTENSION);
+    size_t length;
+    char *name;
+
+    length = strlen(inName);
+    name = (char *)malloc(length + extLength + strlen(DECODE_EXTENSION) + 1);
+
+    if (NULL == name)
+    {
+        return NULL;
+    }
+
+    strcpy(name, inName);
+
+    if (encode)
+    {
+        strcat(name, BATCH_EXTENSION);
+    }
+    else if ((length > extLength) &&
+        (0 == strcmp(&name[length - extLength], BATCH_EXTENSION)))
+    {
+        name[length - extLength] = '\0';
+    }
+    else
+    {
+        strcat(name, DECODE_EXTENSION);
+    }
+
+    return name;
 }
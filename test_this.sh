@@ -1,28 +1,101 @@
 #!/bin/bash
 
-if [ -f foo ]
-then
-    echo this script requies use of a file foo
-    exit 1
-fi
-
-if [ -f bar ]
-then
-    echo this script requies use of a file bar
-    exit 1
-fi
+for F in foo bar baz foo.bwt bar.bwt
+do
+    if [ -e $F ]
+    then
+        echo this script requies use of a file $F
+        exit 1
+    fi
+done
+
+# BLOCK_SIZE that sample was built with
+BLOCK=4096
+FAILED=0
 
 for X in *
 do
     if [ -f "$X" ]
     then
         echo checking $X
-        ./sample -cm -i $X -o foo
-        ./sample -dm -i foo -o bar
-        diff $X bar
+
+        # round trip every method
+        for M in "" m 1 2 r k mrk 2k
+        do
+            ./sample -c$M -i "$X" -o foo
+            ./sample -d$M -i foo -o bar
+            diff "$X" bar || { echo "  -$M failed"; FAILED=1; }
+            ./sample -dp$M -i foo -o bar
+            diff "$X" bar || { echo "  -p$M failed"; FAILED=1; }
+            rm foo
+            rm bar
+        done
+
+        # both decoders write the blocks before a bad one, then fail
+        if [ $(stat -c %s "$X") -gt $BLOCK ]
+        then
+            ./sample -ck -i "$X" -o foo
+            printf '\x01\x02\x03\x04' |
+                dd of=foo bs=1 seek=$((BLOCK + 12)) conv=notrunc 2> /dev/null
+            ./sample -dk -i foo -o bar 2> /dev/null &&
+                { echo "  -k missed a bad block"; FAILED=1; }
+            ./sample -dpk -i foo -o baz 2> /dev/null &&
+                { echo "  -pk missed a bad block"; FAILED=1; }
+            head -c $BLOCK "$X" | cmp -s - bar ||
+                { echo "  -k lost good blocks"; FAILED=1; }
+            cmp -s bar baz || { echo "  -pk lost good blocks"; FAILED=1; }
+            rm foo bar baz
+        fi
+
+        # every work area is released with the size it was allocated with
+        for M in m rk
+        do
+            ./sample -ct$M -i "$X" -o foo ||
+                { echo "  -ct$M failed"; FAILED=1; }
+            ./sample -dt$M -i foo -o bar ||
+                { echo "  -dt$M failed"; FAILED=1; }
+            ./sample -dpt$M -i foo -o bar ||
+                { echo "  -dpt$M failed"; FAILED=1; }
+            rm foo
+            rm bar
+        done
+
+        ./sample -ct -i "$X" -o foo
+        ./sample -at -i "$X" -o foo || { echo "  -at failed"; FAILED=1; }
+        rm foo
+
+        # appending must match transforming in one pass
+        SIZE=$(stat -c %s "$X")
+
+        for M in "" m k
+        do
+            ./sample -c$M -i "$X" -o foo
+
+            for N in 0 1000 $BLOCK $((2 * BLOCK)) $((SIZE / 2)) $SIZE
+            do
+                head -c $N "$X" > bar
+                ./sample -c$M -i bar -o baz
+                tail -c +$((N + 1)) "$X" > bar
+                ./sample -a$M -i bar -o baz
+                cmp -s foo baz || { echo "  -a$M at $N failed"; FAILED=1; }
+                rm bar
+                rm baz
+            done
+
+            rm foo
+        done
+
+        # batches name each output after its input
+        cp "$X" foo
+        cp "$X" bar
+        ./sample -c -i foo -i bar > /dev/null
         rm foo
         rm bar
+        ./sample -d -i foo.bwt -i bar.bwt > /dev/null
+        diff "$X" foo || { echo "  batch failed"; FAILED=1; }
+        diff "$X" bar || { echo "  batch failed"; FAILED=1; }
+        rm foo bar foo.bwt bar.bwt
     fi
 done
 
-exit 0
+exit $FAILED